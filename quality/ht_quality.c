@@ -0,0 +1,411 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/ht.h"
+#include "../src/ht_engine.h"
+
+// ht_quality measures how well the ht_Hash* functions spread keys, in the spirit of SMHasher.
+// Every function runs through the same reports:
+// - avalanche: how often each output bit flips when one input bit flips, 50% is ideal,
+// - bit independence: how correlated the flips of two output bits are, 0 is ideal,
+// - chi-square of bucket occupancy at several capacities, for the bucketIndex the engines use
+//   and for the raw low bits of the hash,
+// - sequential keys, decimal strings and little endian counters, and sparse keys with few bits set,
+//   counting full hash collisions and the chi-square of their buckets,
+// - hashing speed by key length.
+// The length taking variants are measured, the string functions hash the same bytes to the same values.
+// Run with `make quality`.
+
+#define QualityBits (sizeof(unsigned long)*8)
+#define AvalancheSamples 5000
+#define IndependenceSamples 4000
+#define MaxKeyLen 1024
+
+// Verdicts mark results that random hashes exceed with vanishing probability at these sample sizes.
+#define AvalancheMaxBias 0.1
+#define IndependenceMaxCorrelation 0.12
+#define ChiSquareMaxZ 6.0
+
+typedef struct {
+    const char *name;
+    ht_HashFunctionN hash;
+} HashCase;
+
+static const ht_Seed sip_seed = {.k0 = 0x0706050403020100ull, .k1 = 0x0F0E0D0C0B0A0908ull};
+
+static unsigned long hashSip13(const void *key, size_t len) {
+    return ht_HashSip13(key, len, &sip_seed);
+}
+
+static const HashCase cases[] = {
+    {"ht_HashDJB2", ht_HashDJB2N},
+    {"ht_HashSDBM", ht_HashSDBMN},
+    {"ht_HashLL", ht_HashLLN},
+    {"ht_HashWY", ht_HashWYN},
+    {"ht_HashHW", ht_HashHWN},
+    {"ht_HashSip13", hashSip13},
+};
+
+#define CaseCount (sizeof(cases)/sizeof(cases[0]))
+
+static uint64_t rng_state = 0x243F6A8885A308D3ull;
+
+static uint64_t nextRandom(void) {
+    uint64_t z = (rng_state += GoldenRatio);
+    z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27))*0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static void randomBytes(unsigned char *p, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        p[i] = (unsigned char)nextRandom();
+    }
+}
+
+static const char *verdict(int ok) {
+    return ok ? "ok" : "WEAK";
+}
+
+// avalancheBias returns the largest distance from 1/2 of an output bit flip rate, scaled to 0..1.
+static double avalancheBias(ht_HashFunctionN f, size_t len) {
+    static unsigned counts[MaxKeyLen*8/16][QualityBits];
+    unsigned char key[MaxKeyLen];
+    size_t in_bits = len*8;
+    memset(counts, 0, sizeof(counts));
+    for (size_t s = 0; s < AvalancheSamples; s++) {
+        randomBytes(key, len);
+        unsigned long h = f(key, len);
+        for (size_t i = 0; i < in_bits; i++) {
+            key[i/8] ^= (unsigned char)(1u << (i%8));
+            unsigned long d = h ^ f(key, len);
+            key[i/8] ^= (unsigned char)(1u << (i%8));
+            for (size_t o = 0; o < QualityBits; o++) {
+                counts[i][o] += (d >> o) & 1;
+            }
+        }
+    }
+    double worst = 0;
+    for (size_t i = 0; i < in_bits; i++) {
+        for (size_t o = 0; o < QualityBits; o++) {
+            double bias = fabs(2.0*counts[i][o]/AvalancheSamples - 1.0);
+            if (bias > worst) {
+                worst = bias;
+            }
+        }
+    }
+    return worst;
+}
+
+static void reportAvalanche(void) {
+    const size_t lens[] = {3, 8, 16, 64};
+    printf("\n== Avalanche, worst output bit bias over all input bits (0 ideal, 1 bit never or always flips)\n");
+    printf("%-14s", "hash");
+    for (size_t l = 0; l < sizeof(lens)/sizeof(lens[0]); l++) {
+        printf(" %8zuB", lens[l]);
+    }
+    printf("  verdict\n");
+    for (size_t c = 0; c < CaseCount; c++) {
+        double worst = 0;
+        printf("%-14s", cases[c].name);
+        for (size_t l = 0; l < sizeof(lens)/sizeof(lens[0]); l++) {
+            double bias = avalancheBias(cases[c].hash, lens[l]);
+            worst = bias > worst ? bias : worst;
+            printf(" %9.4f", bias);
+        }
+        printf("  %s\n", verdict(worst < AvalancheMaxBias));
+    }
+}
+
+// independenceCorrelation returns the largest correlation between the flips of two output bits
+// when one input bit of an 8 byte key flips.
+static double independenceCorrelation(ht_HashFunctionN f) {
+    static unsigned pairs[QualityBits][QualityBits];
+    unsigned singles[QualityBits];
+    unsigned char key[8];
+    double worst = 0;
+    for (size_t i = 0; i < 64; i++) {
+        memset(pairs, 0, sizeof(pairs));
+        memset(singles, 0, sizeof(singles));
+        for (size_t s = 0; s < IndependenceSamples; s++) {
+            randomBytes(key, sizeof(key));
+            unsigned long h = f(key, sizeof(key));
+            key[i/8] ^= (unsigned char)(1u << (i%8));
+            unsigned long d = h ^ f(key, sizeof(key));
+            for (unsigned long bits = d; bits; bits &= bits - 1) {
+                size_t j = lowestBit(bits);
+                singles[j]++;
+                for (unsigned long rest = bits & (bits - 1); rest; rest &= rest - 1) {
+                    pairs[j][lowestBit(rest)]++;
+                }
+            }
+        }
+        for (size_t j = 0; j < QualityBits; j++) {
+            for (size_t k = j + 1; k < QualityBits; k++) {
+                double n = IndependenceSamples;
+                double var = (double)singles[j]*(n - singles[j])*(double)singles[k]*(n - singles[k]);
+                // A bit that never or always flips is fully dependent on the input.
+                double corr = var > 0 ? fabs(n*pairs[j][k] - (double)singles[j]*singles[k])/sqrt(var) : 1.0;
+                if (corr > worst) {
+                    worst = corr;
+                }
+            }
+        }
+    }
+    return worst;
+}
+
+static void reportIndependence(void) {
+    printf("\n== Bit independence, worst correlation of two output bit flips, 8 byte keys (0 ideal)\n");
+    printf("%-14s %10s  verdict\n", "hash", "worst");
+    for (size_t c = 0; c < CaseCount; c++) {
+        double worst = independenceCorrelation(cases[c].hash);
+        printf("%-14s %10.4f  %s\n", cases[c].name, worst, verdict(worst < IndependenceMaxCorrelation));
+    }
+}
+
+// KeySet holds keys back to back in one buffer.
+typedef struct {
+    unsigned char *bytes;
+    size_t *offsets;
+    size_t *lens;
+    size_t len;
+} KeySet;
+
+static void keySetFree(KeySet *ks) {
+    free(ks->bytes);
+    free(ks->offsets);
+    free(ks->lens);
+    memset(ks, 0, sizeof(KeySet));
+}
+
+static KeySet keySetAlloc(size_t n, size_t total) {
+    KeySet ks = {
+        .bytes = malloc(total),
+        .offsets = malloc(n*sizeof(size_t)),
+        .lens = malloc(n*sizeof(size_t)),
+        .len = 0,
+    };
+    if (!ks.bytes || !ks.offsets || !ks.lens) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return ks;
+}
+
+static void keySetPush(KeySet *ks, size_t *used, const void *key, size_t len) {
+    memcpy(ks->bytes + *used, key, len);
+    ks->offsets[ks->len] = *used;
+    ks->lens[ks->len] = len;
+    ks->len++;
+    *used += len;
+}
+
+static KeySet passwordKeys(void) {
+    FILE *fp = fopen("./test-data/probable-v2-wpa-top4800.txt", "r");
+    if (!fp) {
+        fprintf(stderr, "cannot open test-data, run from the repository root\n");
+        exit(EXIT_FAILURE);
+    }
+    KeySet ks = keySetAlloc(4800, 4800*64);
+    size_t used = 0;
+    char line[64];
+    while (ks.len < 4800 && fgets(line, sizeof(line), fp)) {
+        keySetPush(&ks, &used, line, strcspn(line, "\r\n"));
+    }
+    fclose(fp);
+    return ks;
+}
+
+static KeySet decimalKeys(size_t n) {
+    KeySet ks = keySetAlloc(n, n*16);
+    size_t used = 0;
+    char key[16];
+    for (size_t i = 0; i < n; i++) {
+        int len = snprintf(key, sizeof(key), "key%07zu", i);
+        keySetPush(&ks, &used, key, (size_t)len);
+    }
+    return ks;
+}
+
+static KeySet counterKeys(size_t n) {
+    KeySet ks = keySetAlloc(n, n*8);
+    size_t used = 0;
+    for (size_t i = 0; i < n; i++) {
+        unsigned char key[8];
+        for (size_t b = 0; b < 8; b++) {
+            key[b] = (unsigned char)((uint64_t)i >> (8*b));
+        }
+        keySetPush(&ks, &used, key, sizeof(key));
+    }
+    return ks;
+}
+
+// sparseKeys are the 32 byte keys with at most two bits set.
+static KeySet sparseKeys(void) {
+    const size_t bits = 32*8;
+    size_t n = 1 + bits + bits*(bits - 1)/2;
+    KeySet ks = keySetAlloc(n, n*32);
+    size_t used = 0;
+    unsigned char key[32];
+    memset(key, 0, sizeof(key));
+    keySetPush(&ks, &used, key, sizeof(key));
+    for (size_t i = 0; i < bits; i++) {
+        key[i/8] ^= (unsigned char)(1u << (i%8));
+        keySetPush(&ks, &used, key, sizeof(key));
+        for (size_t j = i + 1; j < bits; j++) {
+            key[j/8] ^= (unsigned char)(1u << (j%8));
+            keySetPush(&ks, &used, key, sizeof(key));
+            key[j/8] ^= (unsigned char)(1u << (j%8));
+        }
+        key[i/8] ^= (unsigned char)(1u << (i%8));
+    }
+    return ks;
+}
+
+static unsigned long *hashKeys(ht_HashFunctionN f, const KeySet *ks) {
+    unsigned long *hashes = malloc(ks->len*sizeof(unsigned long));
+    if (!hashes) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < ks->len; i++) {
+        hashes[i] = f(ks->bytes + ks->offsets[i], ks->lens[i]);
+    }
+    return hashes;
+}
+
+static int compareHashes(const void *a, const void *b) {
+    unsigned long x = *(const unsigned long*)a;
+    unsigned long y = *(const unsigned long*)b;
+    return (x > y) - (x < y);
+}
+
+// collisions counts the keys whose full hash equals the hash of another key, it sorts the hashes.
+static size_t collisions(unsigned long *hashes, size_t n) {
+    qsort(hashes, n, sizeof(unsigned long), compareHashes);
+    size_t count = 0;
+    for (size_t i = 1; i < n; i++) {
+        count += hashes[i] == hashes[i - 1];
+    }
+    return count;
+}
+
+// chiSquareZ returns the chi-square statistic of the bucket counts as a z-score,
+// a distribution as even as random keys gives values within a few units of 0.
+static double chiSquareZ(const unsigned long *hashes, size_t n, size_t cap, int table_index) {
+    size_t *buckets = calloc(cap, sizeof(size_t));
+    if (!buckets) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < n; i++) {
+        buckets[table_index ? bucketIndex(hashes[i], cap) : (hashes[i] & (cap - 1))]++;
+    }
+    double expected = (double)n/(double)cap;
+    double chi = 0;
+    for (size_t b = 0; b < cap; b++) {
+        double d = (double)buckets[b] - expected;
+        chi += d*d/expected;
+    }
+    free(buckets);
+    double dof = (double)cap - 1;
+    return (chi - dof)/sqrt(2*dof);
+}
+
+static void reportDistribution(const char *title, const KeySet *ks, const size_t *caps, size_t ncaps) {
+    printf("\n== %s, %zu keys: full hash collisions, chi-square z of bucketIndex / low bits per capacity\n", title, ks->len);
+    printf("%-14s %10s", "hash", "collisions");
+    for (size_t c = 0; c < ncaps; c++) {
+        printf(" %17zu", caps[c]);
+    }
+    printf("  verdict\n");
+    for (size_t c = 0; c < CaseCount; c++) {
+        unsigned long *hashes = hashKeys(cases[c].hash, ks);
+        int ok = 1;
+        printf("%-14s", cases[c].name);
+        double z[2*8];
+        for (size_t k = 0; k < ncaps && k < 8; k++) {
+            z[2*k] = chiSquareZ(hashes, ks->len, caps[k], 1);
+            z[2*k + 1] = chiSquareZ(hashes, ks->len, caps[k], 0);
+            ok &= fabs(z[2*k]) < ChiSquareMaxZ && fabs(z[2*k + 1]) < ChiSquareMaxZ;
+        }
+        size_t dup = collisions(hashes, ks->len);
+        ok &= dup == 0;
+        printf(" %10zu", dup);
+        for (size_t k = 0; k < ncaps && k < 8; k++) {
+            printf(" %8.1f/%8.1f", z[2*k], z[2*k + 1]);
+        }
+        printf("  %s\n", verdict(ok));
+        free(hashes);
+    }
+}
+
+// speed_sink keeps the timed loops from being optimized away.
+static volatile unsigned long speed_sink;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec*1e-9;
+}
+
+static void reportSpeed(void) {
+    const size_t lens[] = {1, 4, 8, 16, 32, 64, 256, 1024};
+    static unsigned char keys[64][MaxKeyLen];
+    randomBytes(&keys[0][0], sizeof(keys));
+    printf("\n== Speed, nanoseconds per hash by key length\n");
+    printf("%-14s", "hash");
+    for (size_t l = 0; l < sizeof(lens)/sizeof(lens[0]); l++) {
+        printf(" %8zuB", lens[l]);
+    }
+    printf("\n");
+    for (size_t c = 0; c < CaseCount; c++) {
+        printf("%-14s", cases[c].name);
+        for (size_t l = 0; l < sizeof(lens)/sizeof(lens[0]); l++) {
+            size_t reps = (size_t)(1 << 24)/(lens[l] + 16);
+            unsigned long sink = 0;
+            double begin = now();
+            for (size_t r = 0; r < reps; r++) {
+                sink += cases[c].hash(keys[r & 63], lens[l]);
+            }
+            double elapsed = now() - begin;
+            speed_sink += sink;
+            printf(" %9.2f", elapsed*1e9/(double)reps);
+        }
+        printf("\n");
+    }
+}
+
+int main(void) {
+    const size_t small_caps[] = {64, 1024, 16384};
+    const size_t large_caps[] = {1024, 65536, 1 << 20};
+
+    printf("Hash quality of the ht_Hash* functions, verdicts flag results outside of what random hashes give.\n");
+    reportAvalanche();
+    reportIndependence();
+
+    KeySet ks = passwordKeys();
+    reportDistribution("Passwords", &ks, small_caps, 3);
+    keySetFree(&ks);
+
+    ks = decimalKeys(1000000);
+    reportDistribution("Sequential decimal keys key0000000..", &ks, large_caps, 3);
+    keySetFree(&ks);
+
+    ks = counterKeys(1000000);
+    reportDistribution("Sequential 8 byte counters", &ks, large_caps, 3);
+    keySetFree(&ks);
+
+    ks = sparseKeys();
+    reportDistribution("Sparse 32 byte keys with up to two bits set", &ks, small_caps, 3);
+    keySetFree(&ks);
+
+    reportSpeed();
+    return 0;
+}
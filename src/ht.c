@@ -1,6 +1,19 @@
 #include "ht.h"
+#include "ht_engine.h"
 #include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#define KeyCopySize 256
+
+// BatchWindow is the number of keys a batched operation has in flight,
+// enough to keep the cache misses of the keys overlapping without the prefetches evicting each other.
+#define BatchWindow 32
+
+// LoadMinBatch is the fewest keys ht_insert_batch passes to the bulk load of an engine,
+// below it the sort and the allocations of the load cost more than inserting the keys one by one.
+#define LoadMinBatch 64
 
 unsigned long
 ht_HashDJB2(unsigned char *str) {
@@ -34,201 +47,1432 @@ ht_HashLL(unsigned char *str) {
     return hash;
 }
 
-static Entities *newEntity(unsigned char *key, void *value) {
-    Entity *en = malloc(sizeof(Entity));
-    en->key = key;
-    en->value = value;
+// wordByte extracts the i-th byte in memory order of a word loaded by loadWord.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define wordByte(w, i) ((unsigned)((w) >> (56 - 8*(i))) & 0xFF)
+#else
+#define wordByte(w, i) ((unsigned)((w) >> (8*(i))) & 0xFF)
+#endif
 
-    Entities *ens = malloc(sizeof(Entities));
-    ens->cap = 2;
-    ens->arr = calloc(ens->cap, sizeof(Entity*));
-    ens->arr[0] = en;
-    ens->len = 1;
+unsigned long
+ht_HashDJB2N(const void *key, size_t len) {
+    const unsigned char *p = key;
+    unsigned long hash = 5381;
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t w = loadWord(p);
+        for (unsigned i = 0; i < 8; i++)
+            hash = ((hash << 5) + hash) + wordByte(w, i);
+    }
+    while (len--)
+        hash = ((hash << 5) + hash) + *p++;
 
-    return ens;
+    return hash;
 }
 
-static int appendEntity(Entities *ens, unsigned char *key, void *value) {
-    for (size_t i = 0; i < ens->len; i++) {
-        if (strcmp((const char*)(key), (const char*)(ens->arr[i]->key)) == 0) {
-            ens->arr[i]->value = value;
-            return 0;
+unsigned long
+ht_HashSDBMN(const void *key, size_t len) {
+    const unsigned char *p = key;
+    unsigned long hash = 0;
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t w = loadWord(p);
+        for (unsigned i = 0; i < 8; i++)
+            hash = wordByte(w, i) + (hash << 6) + (hash << 16) - hash;
+    }
+    while (len--)
+        hash = *p++ + (hash << 6) + (hash << 16) - hash;
+
+    return hash;
+}
+
+unsigned long
+ht_HashLLN(const void *key, size_t len) {
+    const unsigned char *p = key;
+    unsigned int hash = 0;
+    for (; len >= 8; len -= 8, p += 8) {
+        // Byte pairs are summed in 16 bit lanes, which cannot overflow for 8 bytes,
+        // and the multiplication adds the four lanes up in the top lane.
+        uint64_t w = loadWord(p);
+        uint64_t pairs = (w & 0x00FF00FF00FF00FFull) + ((w >> 8) & 0x00FF00FF00FF00FFull);
+        hash += (unsigned int)((pairs*0x0001000100010001ull) >> 48);
+    }
+    while (len--)
+        hash += *p++;
+
+    return hash;
+}
+
+// mulWide multiplies two words to 128 bits, leaving the low half in a and the high half in b.
+static inline void mulWide(uint64_t *a, uint64_t *b) {
+#if defined(__SIZEOF_INT128__)
+    __extension__ typedef unsigned __int128 uint128;
+    uint128 r = (uint128)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, la = (uint32_t)*a, hb = *b >> 32, lb = (uint32_t)*b;
+    uint64_t hh = ha*hb, hl = ha*lb, lh = la*hb, ll = la*lb;
+    uint64_t mid = (ll >> 32) + (uint32_t)hl + (uint32_t)lh;
+    *a = (mid << 32) | (uint32_t)ll;
+    *b = hh + (hl >> 32) + (lh >> 32) + (mid >> 32);
+#endif
+}
+
+// mulFold multiplies two words to 128 bits and folds the halves together with xor.
+static inline uint64_t mulFold(uint64_t a, uint64_t b) {
+    mulWide(&a, &b);
+    return a ^ b;
+}
+
+static const uint64_t wySecret[4] = {
+    0x2D358DCCAA6C78A5ull, 0x8BB84B93962EACC9ull, 0x4B33A62ED433D4A3ull, 0x4D5A2DA51DE1AA47ull,
+};
+
+unsigned long
+ht_HashWY(unsigned char *str) {
+    return ht_HashWYN(str, strlen((const char*)str));
+}
+
+unsigned long
+ht_HashWYN(const void *key, size_t len) {
+    const unsigned char *p = key;
+    uint64_t seed = mulFold(wySecret[0], wySecret[1]);
+    uint64_t a = 0;
+    uint64_t b = 0;
+    if (len <= 16) {
+        if (len >= 4) {
+            size_t mid = (len >> 3) << 2;
+            a = (loadHalf(p) << 32) | loadHalf(p + mid);
+            b = (loadHalf(p + len - 4) << 32) | loadHalf(p + len - 4 - mid);
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            // Three independent lanes keep the multipliers busy on long keys.
+            uint64_t lane1 = seed;
+            uint64_t lane2 = seed;
+            do {
+                seed = mulFold(loadWord(p) ^ wySecret[1], loadWord(p + 8) ^ seed);
+                lane1 = mulFold(loadWord(p + 16) ^ wySecret[2], loadWord(p + 24) ^ lane1);
+                lane2 = mulFold(loadWord(p + 32) ^ wySecret[3], loadWord(p + 40) ^ lane2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= lane1 ^ lane2;
         }
+        for (; i > 16; i -= 16, p += 16) {
+            seed = mulFold(loadWord(p) ^ wySecret[1], loadWord(p + 8) ^ seed);
+        }
+        a = loadWord(p + i - 16);
+        b = loadWord(p + i - 8);
     }
-    if (ens->len == ens->cap) {
-        ens->cap *= 2;
-        ens->arr = realloc(ens->arr, ens->cap*sizeof(Entity*));
+    a ^= wySecret[1];
+    b ^= seed;
+    mulWide(&a, &b);
+    return (unsigned long)mulFold(a ^ wySecret[0] ^ len, b ^ wySecret[1]);
+}
+
+static inline uint64_t loadLE64(const unsigned char *p) {
+    return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24 |
+           (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+#define rotl64(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define sipRound(v0, v1, v2, v3) \
+    do { \
+        v0 += v1; v1 = rotl64(v1, 13); v1 ^= v0; v0 = rotl64(v0, 32); \
+        v2 += v3; v3 = rotl64(v3, 16); v3 ^= v2; \
+        v0 += v3; v3 = rotl64(v3, 21); v3 ^= v0; \
+        v2 += v1; v1 = rotl64(v1, 17); v1 ^= v2; v2 = rotl64(v2, 32); \
+    } while (0)
+
+unsigned long
+ht_HashSip13(const void *key, size_t len, const ht_Seed *seed) {
+    const unsigned char *p = key;
+    uint64_t v0 = seed->k0 ^ 0x736F6D6570736575ull;
+    uint64_t v1 = seed->k1 ^ 0x646F72616E646F6Dull;
+    uint64_t v2 = seed->k0 ^ 0x6C7967656E657261ull;
+    uint64_t v3 = seed->k1 ^ 0x7465646279746573ull;
+    size_t n = len;
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t m = loadLE64(p);
+        v3 ^= m;
+        sipRound(v0, v1, v2, v3);
+        v0 ^= m;
     }
-    Entity *en = malloc(sizeof(Entity));
-    en->key = key;
-    en->value = value;
-    
-    ens->arr[ens->len] = en;
-    ens->len++;
+    uint64_t last = (uint64_t)len << 56;
+    for (size_t i = 0; i < n; i++) {
+        last |= (uint64_t)p[i] << (8*i);
+    }
+    v3 ^= last;
+    sipRound(v0, v1, v2, v3);
+    v0 ^= last;
+    v2 ^= 0xFF;
+    sipRound(v0, v1, v2, v3);
+    sipRound(v0, v1, v2, v3);
+    sipRound(v0, v1, v2, v3);
+    return (unsigned long)(v0 ^ v1 ^ v2 ^ v3);
+}
 
-    return 0;
+// randomSeed draws the seed from the system random source,
+// falling back to the clock and addresses mixed through splitmix64 where there is none.
+static ht_Seed randomSeed(void) {
+    ht_Seed seed = {0, 0};
+    FILE *f = fopen("/dev/urandom", "rb");
+    if (f) {
+        size_t got = fread(&seed, sizeof(seed), 1, f);
+        fclose(f);
+        if (got == 1) {
+            return seed;
+        }
+    }
+    static uint64_t counter;
+    uint64_t x = (uint64_t)time(NULL) ^ (uint64_t)clock() << 32 ^ (uint64_t)(uintptr_t)&seed ^ ++counter*GoldenRatio;
+    uint64_t *parts[2] = {&seed.k0, &seed.k1};
+    for (size_t i = 0; i < 2; i++) {
+        x += GoldenRatio;
+        uint64_t z = x;
+        z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27))*0x94D049BB133111EBull;
+        *parts[i] = z ^ (z >> 31);
+    }
+    return seed;
+}
+
+// lengthVariant returns the length taking twin of a library hash function, or NULL for other functions.
+static ht_HashFunctionN lengthVariant(ht_HashFunction f) {
+    if (f == ht_HashDJB2) {
+        return ht_HashDJB2N;
+    }
+    if (f == ht_HashSDBM) {
+        return ht_HashSDBMN;
+    }
+    if (f == ht_HashLL) {
+        return ht_HashLLN;
+    }
+    if (f == ht_HashWY) {
+        return ht_HashWYN;
+    }
+    if (f == ht_HashHW) {
+        return ht_HashHWN;
+    }
+    return NULL;
 }
 
-static void *getEntityValue(Entities *ens, unsigned char *key) {
+// The occupied bitmap keeps one bit per bucket of the table, set while the bucket has an entity array.
+// A bucket emptied by deletions frees its array and clears its bit.
+#define OccupiedWord 64
+
+static uint64_t *newOccupied(size_t cap) {
+    return calloc((cap + OccupiedWord - 1)/OccupiedWord, sizeof(uint64_t));
+}
+
+static inline void markOccupied(HT *ht, size_t b) {
+    ht->occupied[b/OccupiedWord] |= (uint64_t)1 << (b%OccupiedWord);
+}
+
+// releaseIfEmpty frees the array of bucket b emptied by a deletion and clears its bit in the bitmap.
+static inline void releaseIfEmpty(Entities *ens, uint64_t *occupied, size_t b) {
+    if (ens->len > 0) {
+        return;
+    }
+    free(ens->arr);
+    ens->arr = NULL;
+    ens->cap = 0;
+    occupied[b/OccupiedWord] &= ~((uint64_t)1 << (b%OccupiedWord));
+}
+
+// nextSetBit returns the first bucket from b on with its bit set in the bitmap of cap buckets, or cap.
+static inline size_t nextSetBit(const uint64_t *occupied, size_t cap, size_t b) {
+    if (b >= cap) {
+        return cap;
+    }
+    size_t w = b/OccupiedWord;
+    size_t words = (cap + OccupiedWord - 1)/OccupiedWord;
+    uint64_t bits = occupied[w] & (~(uint64_t)0 << (b%OccupiedWord));
+    while (!bits) {
+        if (++w == words) {
+            return cap;
+        }
+        bits = occupied[w];
+    }
+    return w*OccupiedWord + lowestBit(bits);
+}
+
+// nextOccupied returns the first bucket of the table from b on that holds an entity array, or cap.
+static inline size_t nextOccupied(const HT *ht, size_t b) {
+    return nextSetBit(ht->occupied, ht->cap, b);
+}
+
+static Entity *getEntity(Entities *ens, const unsigned char *key, size_t len, unsigned long h) {
     for (size_t i = 0; i < ens->len; i++) {
-        if (strcmp((const char*)(key), (const char*)(ens->arr[i]->key)) == 0) {
-            return ens->arr[i]->value;
+        if (sameKey(&ens->arr[i], key, len, h)) {
+            return &ens->arr[i];
         }
     }
     return NULL;
 }
 
-static void *deleteEntitytValue(Entities *ens, unsigned char *key) {
+static Entity *appendEntity(Entities *ens, const unsigned char *key, size_t len, unsigned long h, int *inserted) {
+    Entity *en = getEntity(ens, key, len, h);
+    if (en) {
+        *inserted = 0;
+        return en;
+    }
+    Entity claimed = {
+        .key = (unsigned char*)key,
+        .value = NULL,
+        .hash = h,
+        .key_len = len,
+    };
+    en = pushEntity(ens, claimed);
+    *inserted = en != NULL;
+
+    return en;
+}
+
+static int deleteEntitytValue(Entities *ens, const unsigned char *key, size_t len, unsigned long h, void **value) {
     for (size_t i = 0; i < ens->len; i++) {
-        if (strcmp((const char*)(key), (const char*)(ens->arr[i]->key)) == 0) {
-            void *value = ens->arr[i]->value;
-            free(ens->arr[i]);
+        if (sameKey(&ens->arr[i], key, len, h)) {
+            *value = ens->arr[i].value;
             ens->arr[i] = ens->arr[--ens->len];
-            return value;
+            return 1;
         }
     }
-    return NULL;
+    return 0;
 }
 
 static void freeEntities(Entities *ens) {
-    if (!ens) {
+    free(ens->arr);
+    ens->arr = NULL;
+    ens->len = 0;
+    ens->cap = 0;
+    return;
+}
+
+// migrateBucket moves entities of the old table bucket to the current table.
+// On failure the entities not moved yet stay in the old bucket.
+static int migrateBucket(HT *ht, size_t i) {
+    Entities *ens = &ht->old_table[i];
+    while (ens->len > 0) {
+        Entity *en = &ens->arr[ens->len-1];
+        size_t b = bucketIndex(en->hash, ht->cap);
+        markOccupied(ht, b);
+        if (!pushEntity(&ht->table[b], *en)) {
+            return ht_ErrCannotInsert;
+        }
+        ens->len--;
+    }
+    freeEntities(ens);
+    return 0;
+}
+
+// rehashStep migrates up to steps buckets of the old table and releases it when the migration is done.
+static int rehashStep(HT *ht, size_t steps) {
+    for (; steps > 0 && ht->rehash_idx < ht->old_cap; steps--) {
+        int result = migrateBucket(ht, ht->rehash_idx);
+        if (result != 0) {
+            return result;
+        }
+        ht->rehash_idx++;
+    }
+    if (ht->rehash_idx == ht->old_cap) {
+        free(ht->old_table);
+        free(ht->old_occupied);
+        ht->old_table = NULL;
+        ht->old_occupied = NULL;
+        ht->old_cap = 0;
+        ht->rehash_idx = 0;
+    }
+    return 0;
+}
+
+// rehashProgress advances a pending migration by the configured step,
+// or completes it when the table rehashes all at once.
+static void rehashProgress(HT *ht) {
+    if (!ht->old_table) {
+        return;
+    }
+    rehashStep(ht, ht->rehash_step ? ht->rehash_step : ht->old_cap);
+}
+
+static int chainedInit(HT *ht, size_t cap) {
+    ht->table = calloc(cap, sizeof(Entities));
+    ht->occupied = newOccupied(cap);
+    if (!ht->table || !ht->occupied) {
+        free(ht->table);
+        free(ht->occupied);
+        ht->table = NULL;
+        ht->occupied = NULL;
+        return ht_ErrCannotInsert;
+    }
+    return 0;
+}
+
+static void chainedRelease(HT *ht) {
+    if (!ht->table) {
+        return;
+    }
+    for (size_t i = nextOccupied(ht, 0); i < ht->cap; i = nextOccupied(ht, i + 1)) {
+        freeEntities(&ht->table[i]);
+    }
+    free(ht->table);
+    free(ht->occupied);
+    if (ht->old_table) {
+        size_t i = nextSetBit(ht->old_occupied, ht->old_cap, ht->rehash_idx);
+        for (; i < ht->old_cap; i = nextSetBit(ht->old_occupied, ht->old_cap, i + 1)) {
+            freeEntities(&ht->old_table[i]);
+        }
+        free(ht->old_table);
+        free(ht->old_occupied);
+    }
+    ht->table = NULL;
+    ht->occupied = NULL;
+    ht->old_table = NULL;
+    ht->old_occupied = NULL;
+    ht->old_cap = 0;
+    ht->rehash_idx = 0;
+}
+
+// chainedResize starts a migration to a new table of given capacity.
+// Without a rehash step set all entities are moved right away,
+// otherwise they are moved by rehash_step buckets on every insert, read and delete.
+static int chainedResize(HT *ht, size_t cap) {
+    if (ht->old_table && rehashStep(ht, ht->old_cap) != 0) {
+        return ht_ErrCannotInsert;
+    }
+    Entities *table = calloc(cap, sizeof(Entities));
+    uint64_t *occupied = newOccupied(cap);
+    if (!table || !occupied) {
+        free(table);
+        free(occupied);
+        return ht_ErrCannotInsert;
+    }
+    ht->old_occupied = ht->occupied;
+    ht->old_table = ht->table;
+    ht->old_cap = ht->cap;
+    ht->rehash_idx = 0;
+    ht->table = table;
+    ht->occupied = occupied;
+    ht->cap = cap;
+    setThresholds(ht);
+    rehashProgress(ht);
+
+    return 0;
+}
+
+static Entity *chainedFind(HT *ht, const unsigned char *key, size_t len, unsigned long h) {
+    rehashProgress(ht);
+    if (ht->old_table) {
+        Entity *en = getEntity(&ht->old_table[bucketIndex(h, ht->old_cap)], key, len, h);
+        if (en) {
+            return en;
+        }
+    }
+    return getEntity(&ht->table[bucketIndex(h, ht->cap)], key, len, h);
+}
+
+static Entity *chainedInsert(HT *ht, const unsigned char *key, size_t len, unsigned long h, int *inserted) {
+    rehashProgress(ht);
+    if (ht->old_table) {
+        Entity *en = getEntity(&ht->old_table[bucketIndex(h, ht->old_cap)], key, len, h);
+        if (en) {
+            *inserted = 0;
+            return en;
+        }
+    }
+    size_t b = bucketIndex(h, ht->cap);
+    markOccupied(ht, b);
+    return appendEntity(&ht->table[b], key, len, h, inserted);
+}
+
+static Entity *chainedClaim(HT *ht, const unsigned char *key, size_t len, unsigned long h) {
+    rehashProgress(ht);
+    Entity claimed = {
+        .key = (unsigned char*)key,
+        .value = NULL,
+        .hash = h,
+        .key_len = len,
+    };
+    size_t b = bucketIndex(h, ht->cap);
+    markOccupied(ht, b);
+    return pushEntity(&ht->table[b], claimed);
+}
+
+static void prefetchBucket(const Entities *ens, unsigned long h, unsigned stage) {
+    if (stage == 0) {
+        prefetchRead(ens);
+        return;
+    }
+    if (stage == 1) {
+        prefetchRead(ens->arr);
         return;
     }
     for (size_t i = 0; i < ens->len; i++) {
-        free(ens->arr[i]);
+        if (ens->arr[i].hash == h) {
+            prefetchRead(ens->arr[i].key);
+            return;
+        }
     }
-    free(ens->arr);
-    free(ens);
-    return;
 }
 
+static void chainedPrefetch(const HT *ht, unsigned long h, unsigned stage) {
+    if (ht->old_table) {
+        prefetchBucket(&ht->old_table[bucketIndex(h, ht->old_cap)], h, stage);
+    }
+    prefetchBucket(&ht->table[bucketIndex(h, ht->cap)], h, stage);
+}
+
+// LoadRadixBits is the digit width of the radix sort chainedLoad groups the keys by bucket with.
+#define LoadRadixBits 11
+
+// sortByBucket orders the key indices by bucket with a least significant digit radix sort,
+// it costs a pass over the n keys per digit of the bucket index, whatever the capacity.
+// The sort is stable. order and scratch hold n indices each, returns the one holding the result.
+static size_t *sortByBucket(const size_t *bucket, size_t n, unsigned bits, size_t *order, size_t *scratch) {
+    const size_t mask = ((size_t)1 << LoadRadixBits) - 1;
+    for (size_t i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    for (unsigned shift = 0; shift < bits; shift += LoadRadixBits) {
+        size_t starts[((size_t)1 << LoadRadixBits) + 1] = {0};
+        for (size_t i = 0; i < n; i++) {
+            starts[((bucket[order[i]] >> shift) & mask) + 1]++;
+        }
+        for (size_t d = 0; d < mask + 1; d++) {
+            starts[d + 1] += starts[d];
+        }
+        for (size_t i = 0; i < n; i++) {
+            scratch[starts[(bucket[order[i]] >> shift) & mask]++] = order[i];
+        }
+        size_t *sorted = scratch;
+        scratch = order;
+        order = sorted;
+    }
+    return order;
+}
+
+// chainedLoad sorts the keys by bucket, then grows every chain once
+// and fills the buckets in order, so the entity arrays are written one after another.
+// The sort is stable, a key repeated in the batch keeps its last value.
+// The generic layer calls it only without a pending migration.
+static int chainedLoad(HT *ht, const unsigned char *const keys[], const size_t lens[], const unsigned long hashes[],
+                       void *const values[], size_t n, int unique, size_t *inserted) {
+    size_t *bucket = malloc(3*n*sizeof(size_t));
+    if (!bucket) {
+        return ht_ErrCannotInsert;
+    }
+    for (size_t i = 0; i < n; i++) {
+        bucket[i] = bucketIndex(hashes[i], ht->cap);
+    }
+    size_t *order = sortByBucket(bucket, n, capBits(ht->cap), bucket + n, bucket + 2*n);
+
+    // All chains are grown before any is written, so a failed allocation leaves the table unchanged.
+    int result = 0;
+    for (size_t k = 0, end; k < n; k = end) {
+        size_t b = bucket[order[k]];
+        end = k + 1;
+        while (end < n && bucket[order[end]] == b) {
+            end++;
+        }
+        Entities *ens = &ht->table[b];
+        size_t need = ens->len + end - k;
+        if (need > ens->cap) {
+            Entity *arr = realloc(ens->arr, need*sizeof(Entity));
+            if (!arr) {
+                result = ht_ErrCannotInsert;
+                break;
+            }
+            ens->arr = arr;
+            ens->cap = need;
+            markOccupied(ht, b);
+        }
+    }
+    for (size_t k = 0; k < n && result == 0; k++) {
+        size_t i = order[k];
+        Entities *ens = &ht->table[bucket[i]];
+        Entity *en = unique ? NULL : getEntity(ens, keys[i], lens[i], hashes[i]);
+        if (en) {
+            en->value = values[i];
+            continue;
+        }
+        Entity loaded = {
+            .key = (unsigned char*)keys[i],
+            .value = values[i],
+            .hash = hashes[i],
+            .key_len = lens[i],
+        };
+        ens->arr[ens->len++] = loaded;
+        (*inserted)++;
+    }
+    free(bucket);
+    return result;
+}
+
+static int chainedRemove(HT *ht, const unsigned char *key, size_t len, unsigned long h, void **value) {
+    rehashProgress(ht);
+    if (ht->old_table) {
+        size_t o = bucketIndex(h, ht->old_cap);
+        if (deleteEntitytValue(&ht->old_table[o], key, len, h, value)) {
+            releaseIfEmpty(&ht->old_table[o], ht->old_occupied, o);
+            return 1;
+        }
+    }
+    size_t b = bucketIndex(h, ht->cap);
+    if (!deleteEntitytValue(&ht->table[b], key, len, h, value)) {
+        return 0;
+    }
+    releaseIfEmpty(&ht->table[b], ht->occupied, b);
+    return 1;
+}
+
+// chainedRetain visits the buckets still waiting for migration too, so it does not depend on finishing the rehash.
+static size_t chainedRetain(HT *ht, ht_RetainFunction pred, void *ctx) {
+    size_t removed = 0;
+    if (ht->old_table) {
+        size_t i = nextSetBit(ht->old_occupied, ht->old_cap, ht->rehash_idx);
+        for (; i < ht->old_cap; i = nextSetBit(ht->old_occupied, ht->old_cap, i + 1)) {
+            removed += retainEntities(&ht->old_table[i], pred, ctx);
+            releaseIfEmpty(&ht->old_table[i], ht->old_occupied, i);
+        }
+    }
+    for (size_t i = nextOccupied(ht, 0); i < ht->cap; i = nextOccupied(ht, i + 1)) {
+        removed += retainEntities(&ht->table[i], pred, ctx);
+        releaseIfEmpty(&ht->table[i], ht->occupied, i);
+    }
+    return removed;
+}
+
+// During a migration the iterators walk regions, region i is bucket i of the table together with
+// the old buckets that map to buckets from i on. Capacities are powers of two and buckets are taken
+// from the top bits of the hash, so old bucket o maps to the buckets starting at firstNewBucket(o)
+// and the regions take the old buckets in index order, the order rehash_idx migrates them in.
+
+// firstOldBucket returns the first old bucket mapping to a bucket from i on.
+static inline size_t firstOldBucket(const HT *ht, size_t i) {
+    if (ht->old_cap <= ht->cap) {
+        size_t ratio = ht->cap/ht->old_cap;
+        return (i + ratio - 1)/ratio;
+    }
+    return i*(ht->old_cap/ht->cap);
+}
+
+static inline size_t firstNewBucket(const HT *ht, size_t o) {
+    return ht->old_cap <= ht->cap ? o*(ht->cap/ht->old_cap) : o/(ht->old_cap/ht->cap);
+}
+
+// nextRegion returns the first region from i on that may hold entities, or cap.
+// With migrate set the old buckets of the regions up to it are migrated, so no entity moves into
+// the regions the iterator has passed, and the migration is spread over the iteration.
+// Both bitmaps are scanned together a word of the table at a time, so a sparse table or old table
+// does not make each call scan to its end.
+static size_t nextRegion(HT *ht, size_t i, int migrate) {
+    if (!ht->old_table) {
+        return nextOccupied(ht, i);
+    }
+    size_t r = ht->cap;
+    for (size_t b = i; b < ht->cap; b = (b/OccupiedWord + 1)*OccupiedWord) {
+        size_t last = (b/OccupiedWord + 1)*OccupiedWord;
+        last = last < ht->cap ? last : ht->cap;
+        size_t from = firstOldBucket(ht, b);
+        size_t old_last = firstOldBucket(ht, last);
+        size_t o = nextSetBit(ht->old_occupied, old_last, from > ht->rehash_idx ? from : ht->rehash_idx);
+        size_t found = nextSetBit(ht->occupied, last, b);
+        if (o < old_last && firstNewBucket(ht, o) < found) {
+            found = firstNewBucket(ht, o);
+        }
+        if (found < last) {
+            r = found;
+            break;
+        }
+    }
+    if (migrate && r < ht->cap) {
+        size_t settled = firstOldBucket(ht, r + 1);
+        if (settled > ht->rehash_idx) {
+            rehashStep(ht, settled - ht->rehash_idx);
+        }
+    }
+    return r;
+}
+
+// regionEntity returns the j-th entity of region i, the entities of its old buckets come first, or NULL.
+static Entity *regionEntity(const HT *ht, size_t i, size_t j) {
+    if (ht->old_table) {
+        size_t from = firstOldBucket(ht, i);
+        size_t last = firstOldBucket(ht, i + 1);
+        size_t o = nextSetBit(ht->old_occupied, last, from > ht->rehash_idx ? from : ht->rehash_idx);
+        for (; o < last; o = nextSetBit(ht->old_occupied, last, o + 1)) {
+            const Entities *ens = &ht->old_table[o];
+            if (j < ens->len) {
+                return &ens->arr[j];
+            }
+            j -= ens->len;
+        }
+    }
+    const Entities *ens = &ht->table[i];
+    return j < ens->len ? &ens->arr[j] : NULL;
+}
+
+static Entity *chainedNext(HT *ht, Iterator *it) {
+    int migrate = !it->concurrent;
+    size_t end = iterEnd(ht, it);
+    size_t i = nextRegion(ht, it->hash_table_idx, migrate);
+    size_t j = i == it->hash_table_idx ? it->arr_idx : 0;
+    for (; i < end; i = nextRegion(ht, i + 1, migrate)) {
+        Entity *en = regionEntity(ht, i, j);
+        if (en) {
+            it->hash_table_idx = i;
+            it->arr_idx = j + 1;
+            return en;
+        }
+        j = 0;
+    }
+
+    it->hash_table_idx = end;
+    it->arr_idx = 0;
+    return NULL;
+}
+
+// NextBatchLookahead is how many occupied buckets ahead of the one being read chainedNextBatch prefetches.
+#define NextBatchLookahead 8
+
+// chainedNextBatch fills the batch bucket by bucket. The bucket headers are read in order,
+// the entity arrays they point at are scattered, so the arrays of the buckets ahead are prefetched.
+static size_t chainedNextBatch(HT *ht, Iterator *it, Entity *out[], size_t max) {
+    int migrate = !it->concurrent;
+    size_t end = iterEnd(ht, it);
+    size_t i = nextRegion(ht, it->hash_table_idx, migrate);
+    size_t j = i == it->hash_table_idx ? it->arr_idx : 0;
+    size_t ahead = i;
+    for (unsigned k = 0; k < NextBatchLookahead && ahead < end; k++) {
+        prefetchRead(ht->table[ahead].arr);
+        ahead = nextRegion(ht, ahead + 1, 0);
+    }
+    size_t n = 0;
+    while (i < end) {
+        if (ht->old_table) {
+            for (Entity *en = regionEntity(ht, i, j); en && n < max; en = regionEntity(ht, i, ++j)) {
+                out[n++] = en;
+            }
+        } else {
+            Entities *ens = &ht->table[i];
+            for (; j < ens->len && n < max; j++) {
+                out[n++] = &ens->arr[j];
+            }
+        }
+        if (n == max) {
+            break;
+        }
+        i = nextRegion(ht, i + 1, migrate);
+        j = 0;
+        if (ahead < end) {
+            prefetchRead(ht->table[ahead].arr);
+            ahead = nextRegion(ht, ahead + 1, 0);
+        }
+    }
+    it->hash_table_idx = i < end ? i : end;
+    it->arr_idx = i < end ? j : 0;
+    return n;
+}
+
+static const EngineOps chainedEngine = {
+    .default_max_load = DefaultMaxLoadFactor,
+    .max_load_limit = 0,
+    .init = chainedInit,
+    .release = chainedRelease,
+    .resize = chainedResize,
+    .find = chainedFind,
+    .insert = chainedInsert,
+    .claim = chainedClaim,
+    .load = chainedLoad,
+    .remove = chainedRemove,
+    .retain = chainedRetain,
+    .next = chainedNext,
+    .nextBatch = chainedNextBatch,
+    .prefetch = chainedPrefetch,
+};
+
+static const EngineOps *const engines[] = {
+    [ht_EngineChained] = &chainedEngine,
+    [ht_EngineSwiss] = &ht_swissEngine,
+    [ht_EngineRobinHood] = &ht_robinHoodEngine,
+    [ht_EngineCuckoo] = &ht_cuckooEngine,
+    [ht_EngineHopscotch] = &ht_hopscotchEngine,
+};
+
 HT ht_new(size_t cap, ht_HashFunction f) {
+    return ht_newEngine(cap, f, ht_EngineChained);
+}
+
+HT ht_newEngine(size_t cap, ht_HashFunction f, ht_Engine engine) {
     if (cap < MinSize) {
         cap = MinSize;
     }
-    if (cap > MaxSize) {
-        cap = MaxSize;
-    }
+    cap = roundUpPow2(cap);
     HT ht = {
         .hash_function = f,
+        .hash_function_n = lengthVariant(f),
+        .engine = engine,
         .cap = cap,
+        .min_cap = cap,
         .len = 0,
-        .table = calloc(cap, sizeof(Entities**)),
+        .max_load = engines[engine]->default_max_load,
+        .min_load = DefaultMinLoadFactor,
     };
+    if (engines[engine]->init(&ht, cap) != 0) {
+        ht.cap = 0;
+    }
+    setThresholds(&ht);
     return ht;
 }
 
-int ht_insert(HT *ht, unsigned char *key, void *value) {
+HT ht_newSeeded(size_t cap, ht_HashFunctionSeeded f, ht_Engine engine) {
+    HT ht = ht_newEngine(cap, NULL, engine);
+    ht.hash_function_seeded = f;
+    ht.seed = randomSeed();
+    return ht;
+}
+
+int ht_setLoadFactor(HT *ht, double max_load, double min_load) {
+    if (!ht) {
+        return ht_ErrDoNotExists;
+    }
+    double limit = engines[ht->engine]->max_load_limit;
+    if (!(max_load > 0) || !(min_load >= 0) || !(min_load < max_load/2)) {
+        return ht_ErrInvalidLoadFactor;
+    }
+    if (limit > 0 && max_load > limit) {
+        return ht_ErrInvalidLoadFactor;
+    }
+    ht->max_load = max_load;
+    ht->min_load = min_load;
+    setThresholds(ht);
+    return 0;
+}
+
+int ht_setHashFunctionN(HT *ht, ht_HashFunctionN f) {
+    if (!ht) {
+        return ht_ErrDoNotExists;
+    }
+    if (ht->len > 0) {
+        return ht_ErrCannotInsert;
+    }
+    ht->hash_function_n = f;
+    return 0;
+}
+
+int ht_setFinalizer(HT *ht, int enabled) {
     if (!ht) {
         return ht_ErrDoNotExists;
     }
-    unsigned long h = ht->hash_function(key);
-    size_t idx = (size_t)(h)%ht->cap;
-    if (!ht->table[idx]) {
-        Entities *ens = newEntity(key, value);
-        ht->table[idx] = ens;
+    if (ht->len > 0) {
+        return ht_ErrCannotInsert;
+    }
+    ht->finalize = enabled != 0;
+    return 0;
+}
+
+int ht_setSeed(HT *ht, ht_Seed seed) {
+    if (!ht) {
+        return ht_ErrDoNotExists;
+    }
+    if (ht->len > 0) {
+        return ht_ErrCannotInsert;
+    }
+    ht->seed = seed;
+    return 0;
+}
+
+int ht_setRehashStep(HT *ht, size_t step) {
+    if (!ht) {
+        return ht_ErrDoNotExists;
+    }
+    ht->rehash_step = step;
+    return 0;
+}
+
+// callHash hashes len bytes of the key with the table hash function, terminated tells whether the key is followed by a NUL byte.
+// A hash function without a length variant gets a NUL terminated copy of an unterminated key.
+// Returns 0 on success or ht_ErrCannotInsert if the copy cannot be allocated.
+static int callHash(const HT *ht, const unsigned char *key, size_t len, int terminated, unsigned long *h) {
+    if (ht->hash_function_seeded) {
+        *h = ht->hash_function_seeded(key, len, &ht->seed);
         return 0;
     }
-    Entities *ens = ht->table[idx];
-    int result = appendEntity(ens, key, value);
-    if (result != 0) {
-        return result;
+    if (ht->hash_function_n) {
+        *h = ht->hash_function_n(key, len);
+        return 0;
+    }
+    if (terminated) {
+        *h = ht->hash_function((unsigned char*)key);
+        return 0;
+    }
+    unsigned char buf[KeyCopySize];
+    unsigned char *copy = len < KeyCopySize ? buf : malloc(len + 1);
+    if (!copy) {
+        return ht_ErrCannotInsert;
+    }
+    memcpy(copy, key, len);
+    copy[len] = '\0';
+    *h = ht->hash_function(copy);
+    if (copy != buf) {
+        free(copy);
+    }
+    return 0;
+}
+
+// hashKey is the hash the engines index by, the table finalizer is applied on top of the hash function.
+static int hashKey(const HT *ht, const unsigned char *key, size_t len, int terminated, unsigned long *h) {
+    int err = callHash(ht, key, len, terminated, h);
+    if (err == 0 && ht->finalize) {
+        *h = (unsigned long)finalMix(*h);
+    }
+    return err;
+}
+
+// growForInsert grows the table before an insertion could cross the max load factor,
+// so the entity the insertion returns stays valid for the caller to set the value.
+static void growForInsert(HT *ht) {
+    if (ht->len >= ht->grow_at) {
+        // Failing to grow leaves a correct, only more loaded table, so the insert still proceeds.
+        engines[ht->engine]->resize(ht, ht->cap*2);
+    }
+}
+
+static Entity *insertEntity(HT *ht, const unsigned char *key, size_t len, unsigned long h, int *inserted) {
+    growForInsert(ht);
+    Entity *en = engines[ht->engine]->insert(ht, key, len, h, inserted);
+    if (en && *inserted) {
+        ht->len++;
+    }
+    return en;
+}
+
+// claimEntity is insertEntity for a key the caller guarantees is absent.
+static Entity *claimEntity(HT *ht, const unsigned char *key, size_t len, unsigned long h) {
+    growForInsert(ht);
+    Entity *en = engines[ht->engine]->claim(ht, key, len, h);
+    if (en) {
+        ht->len++;
+    }
+    return en;
+}
+
+static int insertHashed(HT *ht, const unsigned char *key, size_t len, unsigned long h, void *value) {
+    int inserted = 0;
+    Entity *en = insertEntity(ht, key, len, h, &inserted);
+    if (!en) {
+        return ht_ErrCannotInsert;
     }
-    ht->len++;
+    en->value = value;
     return 0;
 }
 
+static void *readHashed(HT *ht, const unsigned char *key, size_t len, unsigned long h) {
+    Entity *en = engines[ht->engine]->find(ht, key, len, h);
+    if (!en) {
+        return NULL;
+    }
+    return en->value;
+}
+
+// shrinkAfterDelete halves the capacity until the table is above the min load factor,
+// so deleting many entities at once resizes the table once.
+static void shrinkAfterDelete(HT *ht) {
+    size_t cap = ht->cap;
+    while (cap/2 >= ht->min_cap && ht->len < (size_t)(ht->min_load*(double)cap)) {
+        cap /= 2;
+    }
+    if (cap != ht->cap) {
+        engines[ht->engine]->resize(ht, cap);
+    }
+}
+
+// removeHashed deletes the entity without shrinking the table.
+static int removeHashed(HT *ht, const unsigned char *key, size_t len, unsigned long h, void **value) {
+    if (!engines[ht->engine]->remove(ht, key, len, h, value)) {
+        return 0;
+    }
+    ht->len--;
+    return 1;
+}
+
+static void *deleteHashed(HT *ht, const unsigned char *key, size_t len, unsigned long h) {
+    void *candidate = NULL;
+    if (!removeHashed(ht, key, len, h, &candidate)) {
+        return NULL;
+    }
+    shrinkAfterDelete(ht);
+
+    return candidate;
+}
+
+static int insertKey(HT *ht, const unsigned char *key, size_t len, int terminated, void *value) {
+    unsigned long h = 0;
+    if (hashKey(ht, key, len, terminated, &h) != 0) {
+        return ht_ErrCannotInsert;
+    }
+    return insertHashed(ht, key, len, h, value);
+}
+
+static void *readKey(HT *ht, const unsigned char *key, size_t len, int terminated) {
+    unsigned long h = 0;
+    if (hashKey(ht, key, len, terminated, &h) != 0) {
+        return NULL;
+    }
+    return readHashed(ht, key, len, h);
+}
+
+static void *deleteKey(HT *ht, const unsigned char *key, size_t len, int terminated) {
+    unsigned long h = 0;
+    if (hashKey(ht, key, len, terminated, &h) != 0) {
+        return NULL;
+    }
+    return deleteHashed(ht, key, len, h);
+}
+
+static void **entryKey(HT *ht, const unsigned char *key, size_t len, int terminated, int *inserted) {
+    unsigned long h = 0;
+    if (hashKey(ht, key, len, terminated, &h) != 0) {
+        return NULL;
+    }
+    int claimed = 0;
+    Entity *en = insertEntity(ht, key, len, h, &claimed);
+    if (inserted) {
+        *inserted = claimed;
+    }
+    return en ? &en->value : NULL;
+}
+
+// hashWindow hashes the keys of a batch window, with the vector kernels of ht_hash_batch when the table allows.
+// Returns 0 on success or ht_ErrCannotInsert if a key copy cannot be allocated.
+static int hashWindow(const HT *ht, const void *const keys[], const size_t lens[], unsigned long hashes[], size_t n) {
+    if (!ht->hash_function_seeded && ht->hash_function_n) {
+        ht_hash_batch(ht->hash_function_n, keys, lens, hashes, n);
+        for (size_t i = 0; ht->finalize && i < n; i++) {
+            hashes[i] = (unsigned long)finalMix(hashes[i]);
+        }
+        return 0;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (hashKey(ht, keys[i], lens[i], 1, &hashes[i]) != 0) {
+            return ht_ErrCannotInsert;
+        }
+    }
+    return 0;
+}
+
+int ht_insert(HT *ht, unsigned char *key, void *value) {
+    if (!ht) {
+        return ht_ErrDoNotExists;
+    }
+    return insertKey(ht, key, strlen((const char*)key), 1, value);
+}
+
 void *ht_read(HT *ht, unsigned char *key) {
     if (!ht) {
         return NULL;
     }
+    return readKey(ht, key, strlen((const char*)key), 1);
+}
 
-    unsigned long h = ht->hash_function(key);
-    size_t idx = (size_t)(h)%ht->cap;
-    Entities *ens = ht->table[idx];
-    if (!ens) {
+void *ht_delete(HT *ht, unsigned char *key) {
+    if (!ht) {
         return NULL;
     }
+    return deleteKey(ht, key, strlen((const char*)key), 1);
+}
+
+int ht_insert_replace(HT *ht, unsigned char *key, void *value, void **replaced) {
+    if (!ht) {
+        return ht_ErrDoNotExists;
+    }
+    int inserted = 0;
+    void **slot = entryKey(ht, key, strlen((const char*)key), 1, &inserted);
+    if (!slot) {
+        return ht_ErrCannotInsert;
+    }
+    if (replaced) {
+        *replaced = inserted ? NULL : *slot;
+    }
+    *slot = value;
+    return 0;
+}
+
+int ht_insert_new(HT *ht, unsigned char *key, void *value) {
+    if (!ht) {
+        return ht_ErrDoNotExists;
+    }
+    size_t len = strlen((const char*)key);
+    unsigned long h = 0;
+    if (hashKey(ht, key, len, 1, &h) != 0) {
+        return ht_ErrCannotInsert;
+    }
+    Entity *en = claimEntity(ht, key, len, h);
+    if (!en) {
+        return ht_ErrCannotInsert;
+    }
+    en->value = value;
+    return 0;
+}
 
-    void *candidate = getEntityValue(ens, key);
-    if (!candidate) {
+size_t ht_read_batch(HT *ht, unsigned char *const keys[], size_t n, void *out_values[]) {
+    if (!ht) {
+        return 0;
+    }
+    const EngineOps *ops = engines[ht->engine];
+    const void *window[BatchWindow];
+    size_t lens[BatchWindow];
+    unsigned long hashes[BatchWindow];
+    size_t found = 0;
+    for (size_t base = 0; base < n; base += BatchWindow) {
+        size_t m = n - base < BatchWindow ? n - base : BatchWindow;
+        for (size_t i = 0; i < m; i++) {
+            window[i] = keys[base + i];
+            lens[i] = strlen((const char*)keys[base + i]);
+        }
+        if (hashWindow(ht, window, lens, hashes, m) != 0) {
+            for (size_t i = 0; i < m; i++) {
+                out_values[base + i] = readKey(ht, keys[base + i], lens[i], 1);
+                found += out_values[base + i] != NULL;
+            }
+            continue;
+        }
+        for (unsigned stage = 0; ops->prefetch && stage < PrefetchStages; stage++) {
+            for (size_t i = 0; i < m; i++) {
+                ops->prefetch(ht, hashes[i], stage);
+            }
+        }
+        for (size_t i = 0; i < m; i++) {
+            out_values[base + i] = readHashed(ht, window[i], lens[i], hashes[i]);
+            found += out_values[base + i] != NULL;
+        }
+    }
+    return found;
+}
+
+size_t ht_delete_batch(HT *ht, unsigned char *const keys[], size_t n, void *out_values[]) {
+    if (!ht) {
+        return 0;
+    }
+    const EngineOps *ops = engines[ht->engine];
+    const void *window[BatchWindow];
+    size_t lens[BatchWindow];
+    unsigned long hashes[BatchWindow];
+    size_t deleted = 0;
+    for (size_t base = 0; base < n; base += BatchWindow) {
+        size_t m = n - base < BatchWindow ? n - base : BatchWindow;
+        for (size_t i = 0; i < m; i++) {
+            window[i] = keys[base + i];
+            lens[i] = strlen((const char*)keys[base + i]);
+        }
+        // A key that fails to hash is not deleted, as with ht_delete.
+        int hashed = hashWindow(ht, window, lens, hashes, m) == 0;
+        for (unsigned stage = 0; hashed && ops->prefetch && stage < PrefetchStages; stage++) {
+            for (size_t i = 0; i < m; i++) {
+                ops->prefetch(ht, hashes[i], stage);
+            }
+        }
+        for (size_t i = 0; i < m; i++) {
+            void *value = NULL;
+            if ((hashed || hashKey(ht, window[i], lens[i], 1, &hashes[i]) == 0) &&
+                removeHashed(ht, window[i], lens[i], hashes[i], &value)) {
+                deleted++;
+            }
+            if (out_values) {
+                out_values[base + i] = value;
+            }
+        }
+    }
+    shrinkAfterDelete(ht);
+    return deleted;
+}
+
+size_t ht_retain(HT *ht, ht_RetainFunction pred, void *ctx) {
+    if (!ht || !pred) {
+        return 0;
+    }
+    size_t removed = engines[ht->engine]->retain(ht, pred, ctx);
+    ht->len -= removed;
+    shrinkAfterDelete(ht);
+    return removed;
+}
+
+int ht_insert_batch(HT *ht, unsigned char *const keys[], void *const values[], size_t n, int flags) {
+    if (!ht) {
+        return ht_ErrDoNotExists;
+    }
+    if (n == 0) {
+        return 0;
+    }
+    const EngineOps *ops = engines[ht->engine];
+    size_t *lens = malloc(n*sizeof(size_t));
+    unsigned long *hashes = malloc(n*sizeof(unsigned long));
+    if (!lens || !hashes) {
+        free(lens);
+        free(hashes);
+        return ht_ErrCannotInsert;
+    }
+    int result = 0;
+    for (size_t base = 0; base < n && result == 0; base += BatchWindow) {
+        const void *window[BatchWindow];
+        size_t m = n - base < BatchWindow ? n - base : BatchWindow;
+        for (size_t i = 0; i < m; i++) {
+            window[i] = keys[base + i];
+            lens[base + i] = strlen((const char*)keys[base + i]);
+        }
+        result = hashWindow(ht, window, &lens[base], &hashes[base], m);
+    }
+
+    // Only keys known to be absent size the table up front, a batch updating present keys must not grow it.
+    int unique = flags & ht_BatchUnique;
+    if (result == 0 && unique) {
+        size_t cap = ht->cap;
+        while ((size_t)(ht->max_load*(double)cap) <= ht->len + n) {
+            cap *= 2;
+        }
+        if (cap > ht->cap) {
+            // Failing to grow leaves a correct, only more loaded table, as in growForInsert.
+            ops->resize(ht, cap);
+        }
+    }
+
+    // Keys are loaded in runs that fit under the max load, so the table grows as the absent keys fill it.
+    // Short runs, and all keys while an incremental migration is pending, are inserted one by one.
+    for (size_t done = 0; done < n && result == 0;) {
+        growForInsert(ht);
+        size_t room = ht->grow_at > ht->len ? ht->grow_at - ht->len : 1;
+        size_t m = n - done < room ? n - done : room;
+        if (ops->load && !ht->old_table && m >= LoadMinBatch) {
+            size_t inserted = 0;
+            result = ops->load(ht, (const unsigned char *const *)&keys[done], &lens[done], &hashes[done], &values[done],
+                               m, unique, &inserted);
+            ht->len += inserted;
+            done += m;
+            continue;
+        }
+        for (size_t end = done + m; done < end; done++) {
+            int inserted = 0;
+            Entity *en = unique ? claimEntity(ht, keys[done], lens[done], hashes[done])
+                                : insertEntity(ht, keys[done], lens[done], hashes[done], &inserted);
+            if (!en) {
+                result = ht_ErrCannotInsert;
+                break;
+            }
+            en->value = values[done];
+        }
+    }
+    free(lens);
+    free(hashes);
+    return result;
+}
+
+int ht_insert_n(HT *ht, const void *key, size_t len, void *value) {
+    if (!ht) {
+        return ht_ErrDoNotExists;
+    }
+    return insertKey(ht, key, len, 0, value);
+}
+
+void *ht_read_n(HT *ht, const void *key, size_t len) {
+    if (!ht) {
         return NULL;
     }
-    return candidate;
+    return readKey(ht, key, len, 0);
 }
 
-void *ht_delete(HT *ht, unsigned char *key) {
+void *ht_delete_n(HT *ht, const void *key, size_t len) {
     if (!ht) {
         return NULL;
     }
+    return deleteKey(ht, key, len, 0);
+}
 
-    unsigned long h = ht->hash_function(key);
-    size_t idx = (size_t)(h)%ht->cap;
-    Entities *ens = ht->table[idx];
-    if (!ens) {
+void **ht_entry(HT *ht, unsigned char *key, int *inserted) {
+    if (!ht) {
         return NULL;
     }
+    return entryKey(ht, key, strlen((const char*)key), 1, inserted);
+}
 
-    void *candidate = deleteEntitytValue(ens, key);
-    if (!candidate) {
+void **ht_entry_n(HT *ht, const void *key, size_t len, int *inserted) {
+    if (!ht) {
         return NULL;
     }
-    ht->len--;
+    return entryKey(ht, key, len, 0, inserted);
+}
 
-    return candidate;
+void *ht_get_or_insert(HT *ht, unsigned char *key, void *value) {
+    int inserted = 0;
+    void **slot = ht_entry(ht, key, &inserted);
+    if (!slot) {
+        return NULL;
+    }
+    if (inserted) {
+        *slot = value;
+    }
+    return *slot;
+}
+
+int ht_update_with(HT *ht, unsigned char *key, ht_UpdateFunction fn, void *ctx) {
+    if (!ht || !fn) {
+        return ht_ErrDoNotExists;
+    }
+    int inserted = 0;
+    void **slot = ht_entry(ht, key, &inserted);
+    if (!slot) {
+        return ht_ErrCannotInsert;
+    }
+    *slot = fn(*slot, inserted, ctx);
+    return 0;
+}
+
+// keyHasher describes how the table hashes keys, only the function callHash picks is kept.
+static ht_Key keyHasher(const HT *ht) {
+    ht_Key k = {
+        .finalize = ht->finalize,
+    };
+    if (ht->hash_function_seeded) {
+        k.hash_function_seeded = ht->hash_function_seeded;
+        k.seed = ht->seed;
+    } else if (ht->hash_function_n) {
+        k.hash_function_n = ht->hash_function_n;
+    } else {
+        k.hash_function = ht->hash_function;
+    }
+    return k;
+}
+
+static int sameHasher(const ht_Key *a, const ht_Key *b) {
+    return a->hash_function == b->hash_function && a->hash_function_n == b->hash_function_n &&
+           a->hash_function_seeded == b->hash_function_seeded &&
+           a->seed.k0 == b->seed.k0 && a->seed.k1 == b->seed.k1 && a->finalize == b->finalize;
+}
+
+// cachedHash takes the hash of the key handle if the table hashes like the table the key was made for.
+static int cachedHash(const HT *ht, const ht_Key *key, unsigned long *h) {
+    ht_Key hasher = keyHasher(ht);
+    if (key->hashed && sameHasher(key, &hasher)) {
+        *h = key->hash;
+        return 0;
+    }
+    return hashKey(ht, key->ptr, key->len, 0, h);
+}
+
+ht_Key ht_key_make(const HT *ht, const void *key, size_t len) {
+    ht_Key k = {
+        .ptr = key,
+        .len = len,
+    };
+    if (!ht) {
+        return k;
+    }
+    ht_Key hasher = keyHasher(ht);
+    hasher.ptr = key;
+    hasher.len = len;
+    hasher.hashed = hashKey(ht, key, len, 0, &hasher.hash) == 0;
+    return hasher;
+}
+
+int ht_insert_key(HT *ht, const ht_Key *key, void *value) {
+    if (!ht || !key) {
+        return ht_ErrDoNotExists;
+    }
+    unsigned long h = 0;
+    if (cachedHash(ht, key, &h) != 0) {
+        return ht_ErrCannotInsert;
+    }
+    return insertHashed(ht, key->ptr, key->len, h, value);
+}
+
+void *ht_read_key(HT *ht, const ht_Key *key) {
+    if (!ht || !key) {
+        return NULL;
+    }
+    unsigned long h = 0;
+    if (cachedHash(ht, key, &h) != 0) {
+        return NULL;
+    }
+    return readHashed(ht, key->ptr, key->len, h);
+}
+
+void *ht_delete_key(HT *ht, const ht_Key *key) {
+    if (!ht || !key) {
+        return NULL;
+    }
+    unsigned long h = 0;
+    if (cachedHash(ht, key, &h) != 0) {
+        return NULL;
+    }
+    return deleteHashed(ht, key->ptr, key->len, h);
 }
 
 Iterator ht_newIterator(void) {
     Iterator it = {
         .hash_table_idx = 0,
-        .arr_idx = 0
+        .arr_idx = 0,
+        .end_idx = SIZE_MAX,
+        .concurrent = 0
     };
     return it;
 }
 
+// The range bounds are rounded to IterRangeAlign, which keeps swiss groups and occupancy bitmap words
+// within one range. The last range runs to the end, it covers the stash too.
+#define IterRangeAlign 64
+
+Iterator ht_iterator_range(HT *ht, size_t part, size_t nparts) {
+    Iterator it = ht_newIterator();
+    if (!ht || nparts == 0 || part >= nparts) {
+        it.hash_table_idx = 0;
+        it.end_idx = 0;
+        return it;
+    }
+    it.concurrent = 1;
+    it.hash_table_idx = ht->cap/nparts*part & ~(size_t)(IterRangeAlign - 1);
+    if (part + 1 < nparts) {
+        it.end_idx = ht->cap/nparts*(part + 1) & ~(size_t)(IterRangeAlign - 1);
+    }
+    return it;
+}
+
 Entity *ht_next(HT *ht, Iterator *it) {
     if (!ht || !it) {
         return NULL;
     }
-    size_t i = it->hash_table_idx;
-    size_t j = it->arr_idx;
-    for (; i < ht->cap; i++) {
-        Entities *ens = ht->table[i];
-        if (!ens) {
-            j = 0;
-            continue;
-        }
-        if (j >= ens->len) {
-            j = 0;
-            continue;
+    return engines[ht->engine]->next(ht, it);
+}
+
+size_t ht_next_batch(HT *ht, Iterator *it, Entity *out[], size_t max) {
+    if (!ht || !it || !out) {
+        return 0;
+    }
+    const EngineOps *ops = engines[ht->engine];
+    if (ops->nextBatch) {
+        return ops->nextBatch(ht, it, out, max);
+    }
+    size_t n = 0;
+    for (; n < max; n++) {
+        Entity *en = ops->next(ht, it);
+        if (!en) {
+            break;
         }
-        Entity *en = ens->arr[j];
-        it->hash_table_idx = i;
-        it->arr_idx = j+1;
-        return en;
+        out[n] = en;
     }
-
-    it->hash_table_idx = ht->cap;
-    it->arr_idx = 0;
-    return NULL;
+    return n;
 }
 
 void ht_free(HT *ht) {
     if (!ht) {
         return;
     }
-    if (!ht->table) {
+    if (!ht->table && !ht->slots) {
         return;
     }
-    for (size_t i = 0; i < ht->cap; i++) {
-        Entities *ens = ht->table[i];
-        if (ens) {
-            freeEntities(ens);
-        }
-    }
-    free(ht->table);
+    engines[ht->engine]->release(ht);
     ht->cap = 0;
     ht->len = 0;
-    ht->table = NULL;
     return;
 }
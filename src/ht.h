@@ -2,15 +2,42 @@
 #define ht_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #define MinSize 10000
+
+/// MaxSize is deprecated, the table is no longer capped at it and grows by the load factor.
+/// It is kept so code referring to the former bucket cap still builds.
 #define MaxSize 65535
 
-#define ht_ErrCannotInsert 1;
-#define ht_ErrDoNotExists 2;
+#define DefaultMaxLoadFactor 1.0
+#define DefaultMinLoadFactor 0.0
+
+#define ht_ErrCannotInsert 1
+#define ht_ErrDoNotExists 2
+#define ht_ErrInvalidLoadFactor 3
+
+/// ht_BatchUnique flags a batch of keys that are distinct and not in the table, so no keys are compared.
+#define ht_BatchUnique 1
 
 typedef unsigned long (*ht_HashFunction)(unsigned char *);
 
+/// ht_HashFunctionN hashes len bytes of the key, the key does not need to be NUL terminated.
+typedef unsigned long (*ht_HashFunctionN)(const void *, size_t);
+
+/// ht_Seed is the secret key of a keyed hash function.
+typedef struct {
+    uint64_t k0;
+    uint64_t k1;
+} ht_Seed;
+
+/// ht_HashFunctionSeeded hashes len bytes of the key under the secret seed of the table.
+typedef unsigned long (*ht_HashFunctionSeeded)(const void *, size_t, const ht_Seed *);
+
+/// ht_UpdateFunction returns the new value of a key from its current value,
+/// NULL with inserted set to 1 for a key that was not in the table, and the caller context.
+typedef void *(*ht_UpdateFunction)(void *value, int inserted, void *ctx);
+
 /// ht_HashDJB2 hashes the nullable string.
 /// It uses djb2 hashing algorithm 
 /// Written by Daniel J. Bernstein (also known as djb), 
@@ -46,45 +73,286 @@ ht_HashSDBM(unsigned char *str);
 unsigned long
 ht_HashLL(unsigned char *str);
 
+/// ht_HashWY hashes the nullable string.
+/// It uses a wyhash style algorithm, it reads the string 8 bytes at a time
+/// and mixes the words with 64 by 64 to 128 bit multiplications,
+/// so every input bit affects every bit of the hash.
+/// It is much faster than the byte at a time hashes above for keys longer than a few bytes.
+///
+/// str - is a string to be hashed.
+unsigned long
+ht_HashWY(unsigned char *str);
+
+/// ht_HashHW hashes the nullable string with the hash instructions of the CPU.
+/// On x86-64 it uses AES-NI rounds or SSE4.2 CRC32C, on ARMv8 the CRC32C instructions,
+/// picked from the CPU features once when the library is loaded, and ht_HashWY on other CPUs.
+/// The hash differs between CPUs, so it must not be persisted or sent to other machines.
+///
+/// str - is a string to be hashed.
+unsigned long
+ht_HashHW(unsigned char *str);
+
+/// ht_HashDJB2N hashes len bytes of the key with the djb2 algorithm.
+/// It returns the same hash as ht_HashDJB2 for a key without NUL bytes,
+/// but reads the key 8 bytes at a time and does not look for the terminator.
+///
+/// key - bytes to be hashed.
+/// len - number of bytes.
+unsigned long
+ht_HashDJB2N(const void *key, size_t len);
+
+/// ht_HashSDBMN hashes len bytes of the key with the sdbm algorithm.
+/// It returns the same hash as ht_HashSDBM for a key without NUL bytes,
+/// but reads the key 8 bytes at a time and does not look for the terminator.
+///
+/// key - bytes to be hashed.
+/// len - number of bytes.
+unsigned long
+ht_HashSDBMN(const void *key, size_t len);
+
+/// ht_HashLLN hashes len bytes of the key with the loss loss algorithm.
+/// It returns the same hash as ht_HashLL for a key without NUL bytes,
+/// summing 8 bytes at a time in the lanes of a word.
+///
+/// key - bytes to be hashed.
+/// len - number of bytes.
+unsigned long
+ht_HashLLN(const void *key, size_t len);
+
+/// ht_HashWYN hashes len bytes of the key with the wyhash style algorithm of ht_HashWY.
+/// It returns the same hash as ht_HashWY for a key without NUL bytes.
+///
+/// key - bytes to be hashed.
+/// len - number of bytes.
+unsigned long
+ht_HashWYN(const void *key, size_t len);
+
+/// ht_HashHWN hashes len bytes of the key with the hash instructions of ht_HashHW.
+/// It returns the same hash as ht_HashHW for a key without NUL bytes.
+///
+/// key - bytes to be hashed.
+/// len - number of bytes.
+unsigned long
+ht_HashHWN(const void *key, size_t len);
+
+/// ht_hash_batch hashes n keys given by pointers and lengths with a length taking hash function.
+/// ht_HashDJB2N and ht_HashSDBMN hash groups of eight keys at once in AVX2 or NEON vector lanes,
+/// when the CPU has them, other functions hash the keys one by one.
+/// The hashes are the same as of the scalar function.
+///
+/// f - length taking hashing function pointer.
+/// keys - pointers to the keys.
+/// lens - number of bytes of each key.
+/// out_hashes - array of n hashes to be filled.
+/// n - number of keys.
+void ht_hash_batch(ht_HashFunctionN f, const void *const keys[], const size_t lens[], unsigned long out_hashes[], size_t n);
+
+/// ht_HashSip13 hashes len bytes of the key with SipHash-1-3 keyed by the seed.
+/// Without the seed an attacker cannot choose keys that collide,
+/// so it is the hash for tables filled from untrusted input, see ht_newSeeded.
+///
+/// key - bytes to be hashed.
+/// len - number of bytes.
+/// seed - secret key of the hash.
+unsigned long
+ht_HashSip13(const void *key, size_t len, const ht_Seed *seed);
+
 /// Iterator keeps track of the hash map iteration.
+/// It visits the buckets or slots from hash_table_idx up to end_idx, the stash of an engine comes after the slots.
+/// A concurrent iterator, made by ht_iterator_range, only reads the table, so many of them can run at once.
 typedef struct iterator {
     size_t hash_table_idx;
     size_t arr_idx;
+    size_t end_idx;
+    int concurrent;
 } Iterator;
 
 
 /// Entity contains of a key and value of the thing stored in a hash map.
+/// The hash of the key is cached so lookups compare it before the key
+/// and resizing does not recompute it.
+/// The key is key_len bytes long, keys inserted with ht_insert are followed by a NUL byte.
 typedef struct entity {
     unsigned char *key;
     void *value;
+    unsigned long hash;
+    size_t key_len;
 } Entity;
 
+/// ht_RetainFunction returns 1 to keep the entity in the table and 0 to remove it, ctx is the caller context.
+/// It may free the value of an entity it removes, but must not change the table.
+typedef int (*ht_RetainFunction)(const Entity *en, void *ctx);
+
+/// ht_VisitFunction is called for every entity by ht_for_each_parallel,
+/// worker is the index of the thread calling it, from 0 to the number of workers of the pool - 1,
+/// so results can be accumulated per worker without locks, ctx is the caller context.
+typedef void (*ht_VisitFunction)(Entity *en, size_t worker, void *ctx);
+
+/// ht_Pool is a set of worker threads kept between the scans of ht_for_each_parallel.
+typedef struct ht_pool ht_Pool;
+
+/// Entities is a bucket, it stores its entities by value in a contiguous array.
 typedef struct entities {
-    Entity **arr;
+    Entity *arr;
     size_t len;
     size_t cap;
 } Entities;
 
+/// ht_Engine selects the storage layout of the hash table.
+///
+/// ht_EngineChained - buckets of entity arrays, supports incremental rehashing.
+/// ht_EngineSwiss - open addressing with a control byte per slot, probed 16 slots at a time.
+/// ht_EngineRobinHood - open addressing with linear Robin Hood probing, no memory besides the slots.
+/// ht_EngineCuckoo - bucketized cuckoo hashing, a lookup scans the tag bytes of at most two 4-way buckets.
+/// ht_EngineHopscotch - hopscotch hashing, every entity stays within 32 slots of its home slot.
+typedef enum {
+    ht_EngineChained,
+    ht_EngineSwiss,
+    ht_EngineRobinHood,
+    ht_EngineCuckoo,
+    ht_EngineHopscotch,
+} ht_Engine;
+
 /// HT is a hash table entity of key value pairs.
-/// Key in a char* nullable string.
+/// Key in a char* nullable string or, with the _n functions, any len bytes.
 /// Value is a void pointer. 
 /// The caller responsibility is to manage memory allocated to store the value.
+///
+/// The table grows (doubles cap) when len exceeds max_load * cap,
+/// and shrinks (halves cap, never below min_cap) when len drops under min_load * cap.
+/// While resizing, entities still waiting for migration live in old_table,
+/// buckets below rehash_idx are already moved to table.
+/// The occupied bitmap has a bit set for every bucket of table holding an entity array,
+/// so iterating and freeing jump over the empty buckets, old_occupied is the bitmap of old_table.
+/// Open addressing engines keep entities in the cap slots instead of the table buckets,
+/// entities the cuckoo and hopscotch engines cannot place in the slots are kept in the stash.
+/// The ctrl array holds a byte per slot, the control byte of the swiss engine and the tag of the cuckoo engine.
 typedef struct {
     ht_HashFunction hash_function;
-    Entities **table;
+    ht_HashFunctionN hash_function_n;
+    ht_HashFunctionSeeded hash_function_seeded;
+    ht_Seed seed;
+    int finalize;
+    ht_Engine engine;
+    Entities *table;
+    uint64_t *occupied;
     size_t len;
     size_t cap;
+    size_t min_cap;
+    double max_load;
+    double min_load;
+    size_t grow_at;
+    size_t shrink_at;
+    Entities *old_table;
+    uint64_t *old_occupied;
+    size_t old_cap;
+    size_t rehash_idx;
+    size_t rehash_step;
+    Entity *slots;
+    unsigned char *ctrl;
+    size_t tombstones;
+    uint32_t *hops;
+    Entities stash;
 } HT;
 
+/// ht_Key is a key hashed once by ht_key_make, to be looked up in any number of tables.
+/// The _key functions take the cached hash on tables that hash keys the same way as the table
+/// the key was made for, with the same hash function, seed and finalizer, and rehash the key otherwise.
+/// The key bytes are not copied and must outlive the handle.
+typedef struct {
+    const unsigned char *ptr;
+    size_t len;
+    unsigned long hash;
+    int hashed;
+    ht_HashFunction hash_function;
+    ht_HashFunctionN hash_function_n;
+    ht_HashFunctionSeeded hash_function_seeded;
+    ht_Seed seed;
+    int finalize;
+} ht_Key;
+
 /// ht_new creates a new has table of initial size.
 /// Returns pointer to underlining hash table.
 ///
-/// cap - capacity of the hash table.
+/// cap - initial capacity of the hash table rounded up to the power of two,
+///       it is also the lowest capacity the table shrinks to.
 /// f - hashing function pointer.
 HT ht_new(size_t cap, ht_HashFunction f);
 
+/// ht_newEngine creates a new has table of initial size stored by the given engine.
+/// All the operations behave the same regardless of the engine.
+/// Returns pointer to underlining hash table.
+///
+/// cap - initial capacity of the hash table rounded up to the power of two,
+///       it is also the lowest capacity the table shrinks to.
+/// f - hashing function pointer.
+/// engine - storage layout of the hash table.
+HT ht_newEngine(size_t cap, ht_HashFunction f, ht_Engine engine);
+
+/// ht_newSeeded creates a new has table of initial size hashed by a keyed hash function.
+/// The seed of the hash function is drawn from the system random source for every table,
+/// so the bucket of a key cannot be predicted from outside the process.
+/// Returns pointer to underlining hash table.
+///
+/// cap - initial capacity of the hash table rounded up to the power of two,
+///       it is also the lowest capacity the table shrinks to.
+/// f - keyed hashing function pointer, e.g. ht_HashSip13.
+/// engine - storage layout of the hash table.
+HT ht_newSeeded(size_t cap, ht_HashFunctionSeeded f, ht_Engine engine);
+
+/// ht_setLoadFactor sets the load factors that drive the table growth and shrinking.
+/// Returns 0 on success or ht_ErrInvalidLoadFactor if factors are out of range.
+///
+/// ht - pointer to the hash table.
+/// max_load - average number of entities per bucket above which the table doubles, must be positive,
+///            open addressing engines accept values up to their slot limit (0.9375 for swiss, 0.95 for robin hood, cuckoo and hopscotch).
+/// min_load - average number of entities per bucket below which the table halves,
+///            0 disables shrinking, must be lower than max_load / 2 to avoid resize thrashing.
+int ht_setLoadFactor(HT *ht, double max_load, double min_load);
+
+/// ht_setHashFunctionN sets the hash function used by the length taking operations.
+/// Tables of the library hash functions use their length variants, e.g. ht_HashDJB2N, by default.
+/// With no length variant the table hashes a NUL terminated copy of keys passed by length.
+/// The function must return the same hash as the table hash function for keys without NUL bytes.
+/// Returns 0 on success, ht_ErrCannotInsert if the table is not empty or error value otherwise.
+///
+/// ht - pointer to the hash table.
+/// f - length taking hashing function pointer, NULL to hash copies of the keys.
+int ht_setHashFunctionN(HT *ht, ht_HashFunctionN f);
+
+/// ht_setSeed replaces the random seed of a table created by ht_newSeeded,
+/// e.g. to reproduce a table layout in tests.
+/// Returns 0 on success, ht_ErrCannotInsert if the table is not empty or error value otherwise.
+///
+/// ht - pointer to the hash table.
+/// seed - secret key of the hash function.
+int ht_setSeed(HT *ht, ht_Seed seed);
+
+/// ht_setFinalizer turns on or off the fmix64 finalizer applied to every hash before the bucket is selected.
+/// It repairs hash functions that leave bits unmixed, e.g. ht_HashLL or own functions of the caller,
+/// at the cost of a few multiplications per operation, keys with equal hashes still collide.
+/// The finalized hash is the one kept in the entity. Off by default.
+/// Returns 0 on success, ht_ErrCannotInsert if the table is not empty or error value otherwise.
+///
+/// ht - pointer to the hash table.
+/// enabled - 1 to finalize the hashes, 0 to use them as returned by the hash function.
+int ht_setFinalizer(HT *ht, int enabled);
+
+/// ht_setRehashStep sets how the entities are migrated when the table resizes.
+/// With step 0, the default, the whole table is rehashed by the insert or delete that triggers the resize.
+/// With step above 0 the old table is kept next to the new one and every insert, read and delete
+/// moves step buckets, so no single operation pays for the whole rehash.
+/// Note that in the incremental mode ht_read modifies the table.
+/// Only the chained engine rehashes incrementally, other engines ignore the step.
+/// Returns 0 on success or error value otherwise.
+///
+/// ht - pointer to the hash table.
+/// step - number of buckets migrated per operation.
+int ht_setRehashStep(HT *ht, size_t step);
+
 /// ht_insert inserts a value pointer with given key to the hash table.
 /// Value is updated if exists in the hash table.
+/// The table grows when the insertion crosses the max load factor.
 /// Returns 0 if insert succeeded or error value otherwise.
 ///
 /// ht - pointer to the hash table.
@@ -103,6 +371,7 @@ void *ht_read(HT *ht, unsigned char *key);
 
 
 /// ht_delete deletes a value from the hash table.
+/// The table shrinks when the deletion crosses the min load factor.
 /// Returns pointer to the value or NULL otherwise;
 /// Caller responsibility is to free the memory allocated for the value.
 ///
@@ -110,16 +379,229 @@ void *ht_read(HT *ht, unsigned char *key);
 /// key - char* nullable string that represents the key.
 void *ht_delete(HT *ht, unsigned char *key);
 
+/// ht_insert_replace inserts the value with the key into the hash table, replacing the value of a present key.
+/// Unlike a read followed by an insert, it finds the key once, so values owned by the caller can be freed without leaks.
+/// Returns 0 on success or error value otherwise.
+///
+/// ht - pointer to the hash table.
+/// key - a nullable string.
+/// value - a void pointer to the underlining entity.
+/// replaced - set to the value the key had, NULL if the key was inserted, may be NULL.
+int ht_insert_replace(HT *ht, unsigned char *key, void *value, void **replaced);
+
+/// ht_insert_new inserts the value with a key the caller guarantees is not in the hash table.
+/// No keys are compared, which makes bulk loads of unique keys faster,
+/// inserting a present key leaves the table with two entities of the key.
+/// Returns 0 on success or error value otherwise.
+///
+/// ht - pointer to the hash table.
+/// key - a nullable string.
+/// value - a void pointer to the underlining entity.
+int ht_insert_new(HT *ht, unsigned char *key, void *value);
+
+/// ht_read_batch reads the values of n keys from the hash table.
+/// The keys are hashed first, then the memory each lookup needs is prefetched for all of them in stages,
+/// so on tables larger than the CPU caches the memory latency of the keys overlaps instead of adding up.
+/// Returns the number of keys found.
+///
+/// ht - pointer to the hash table.
+/// keys - nullable strings.
+/// n - number of keys.
+/// out_values - set to the value of each key or NULL if the key is absent.
+size_t ht_read_batch(HT *ht, unsigned char *const keys[], size_t n, void *out_values[]);
+
+/// ht_insert_batch inserts n values with their keys into the hash table as a bulk load.
+/// The keys are hashed up front, a batch flagged ht_BatchUnique sizes the table once for all keys,
+/// other batches grow it only as far as the keys absent from the table need.
+/// The chained engine groups the keys by bucket to grow every chain with a single allocation,
+/// during an incremental migration it inserts them one by one, so each step stays short.
+/// Inserting a key twice keeps the value that comes later in the batch.
+/// Returns 0 on success or error value otherwise, on failure the table holds a part of the batch.
+///
+/// ht - pointer to the hash table.
+/// keys - nullable strings.
+/// values - void pointers to the underlining entities.
+/// n - number of keys.
+/// flags - ht_BatchUnique or 0.
+int ht_insert_batch(HT *ht, unsigned char *const keys[], void *const values[], size_t n, int flags);
+
+/// ht_delete_batch deletes n keys from the hash table.
+/// The lookups are prefetched in stages as in ht_read_batch, and the table shrinks once after all the deletions.
+/// Returns the number of keys deleted.
+/// Caller responsibility is to free the memory allocated for the values.
+///
+/// ht - pointer to the hash table.
+/// keys - nullable strings.
+/// n - number of keys.
+/// out_values - set to the value of each key or NULL if the key was absent, may be NULL.
+size_t ht_delete_batch(HT *ht, unsigned char *const keys[], size_t n, void *out_values[]);
+
+/// ht_retain keeps the entities the predicate accepts and deletes the others in a single pass over the table.
+/// Unlike collecting keys with ht_next and deleting them, no key is hashed or looked up again,
+/// the chained engine compacts each bucket in place. The table shrinks once after the pass.
+/// Returns the number of entities deleted.
+///
+/// ht - pointer to the hash table.
+/// pred - called once per entity, returns 0 for the entities to delete.
+/// ctx - passed to the predicate.
+size_t ht_retain(HT *ht, ht_RetainFunction pred, void *ctx);
+
+/// ht_insert_n inserts a value pointer with the key of len bytes to the hash table.
+/// The key may contain any bytes and does not need a terminator,
+/// so it may point into a larger buffer that outlives the entity.
+/// It finds the same entity as ht_insert of a NUL terminated key of len bytes.
+/// Returns 0 if insert succeeded or error value otherwise.
+///
+/// ht - pointer to the hash table.
+/// key - pointer to the key bytes.
+/// len - number of bytes of the key.
+/// value - a void pointer to the underlining entity.
+int ht_insert_n(HT *ht, const void *key, size_t len, void *value);
+
+/// ht_read_n reads a value with the key of len bytes from the hash table if value exists.
+/// Returns pointer to the value or NULL otherwise.
+///
+/// ht - pointer to the hash table.
+/// key - pointer to the key bytes.
+/// len - number of bytes of the key.
+void *ht_read_n(HT *ht, const void *key, size_t len);
+
+/// ht_delete_n deletes a value with the key of len bytes from the hash table.
+/// Returns pointer to the value or NULL otherwise.
+///
+/// ht - pointer to the hash table.
+/// key - pointer to the key bytes.
+/// len - number of bytes of the key.
+void *ht_delete_n(HT *ht, const void *key, size_t len);
+
+/// ht_entry finds the key in the hash table, inserting it with a NULL value if it is absent,
+/// with one hashing and one lookup, e.g. to count keys with `(*slot) = (void*)((uintptr_t)*slot + 1)`.
+/// Returns pointer to the value slot, valid until the next call on the table, or NULL if the key cannot be inserted.
+/// In the incremental rehash mode ht_read and ht_next migrate buckets too, so the slot may move on any call.
+///
+/// ht - pointer to the hash table.
+/// key - a nullable string.
+/// inserted - set to 1 if the key was inserted, 0 if it was in the table, may be NULL.
+void **ht_entry(HT *ht, unsigned char *key, int *inserted);
+
+/// ht_entry_n is ht_entry with the key of len bytes.
+///
+/// ht - pointer to the hash table.
+/// key - pointer to the key bytes.
+/// len - number of bytes of the key.
+/// inserted - set to 1 if the key was inserted, 0 if it was in the table, may be NULL.
+void **ht_entry_n(HT *ht, const void *key, size_t len, int *inserted);
+
+/// ht_get_or_insert reads the value of the key, inserting the given value if the key is absent.
+/// Returns the value in the table after the call or NULL if the key cannot be inserted.
+///
+/// ht - pointer to the hash table.
+/// key - a nullable string.
+/// value - a void pointer inserted for an absent key.
+void *ht_get_or_insert(HT *ht, unsigned char *key, void *value);
+
+/// ht_update_with sets the value of the key to the one returned by fn for its current value,
+/// inserting the key if it is absent, with one hashing and one lookup.
+/// Returns 0 on success or error value otherwise.
+///
+/// ht - pointer to the hash table.
+/// key - a nullable string.
+/// fn - function returning the new value.
+/// ctx - caller context passed to fn.
+int ht_update_with(HT *ht, unsigned char *key, ht_UpdateFunction fn, void *ctx);
+
+/// ht_key_make hashes the key of len bytes the way the hash table does, for the _key functions.
+/// Returns the key handle, if hashing fails the handle is left unhashed and the _key functions hash the key.
+///
+/// ht - pointer to the hash table whose hashing the key takes.
+/// key - pointer to the key bytes.
+/// len - number of bytes of the key.
+ht_Key ht_key_make(const HT *ht, const void *key, size_t len);
+
+/// ht_insert_key inserts the value with the key handle into the hash table, without hashing the key again.
+/// Returns 0 on success or error value otherwise.
+///
+/// ht - pointer to the hash table.
+/// key - pointer to the key handle made by ht_key_make.
+/// value - a void pointer to the underlining entity.
+int ht_insert_key(HT *ht, const ht_Key *key, void *value);
+
+/// ht_read_key reads a value with the key handle from the hash table, without hashing the key again.
+/// Returns pointer to the value or NULL otherwise.
+///
+/// ht - pointer to the hash table.
+/// key - pointer to the key handle made by ht_key_make.
+void *ht_read_key(HT *ht, const ht_Key *key);
+
+/// ht_delete_key deletes a value with the key handle from the hash table, without hashing the key again.
+/// Returns pointer to the value or NULL otherwise.
+///
+/// ht - pointer to the hash table.
+/// key - pointer to the key handle made by ht_key_make.
+void *ht_delete_key(HT *ht, const ht_Key *key);
+
 /// ht_newIterator creates new iterator.
 Iterator ht_newIterator(void);
 
+/// ht_iterator_range creates an iterator over the part of nparts disjoint ranges of the table,
+/// together the ranges cover every entity once, so nparts threads can scan the table in parallel.
+/// The ranges only read the table, buckets still waiting for an incremental migration are read in place.
+/// No other call may be made on the table during the scan, ht_read too migrates buckets in the incremental mode.
+///
+/// ht - pointer to the hash table.
+/// part - index of the range, from 0 to nparts - 1.
+/// nparts - number of ranges.
+Iterator ht_iterator_range(HT *ht, size_t part, size_t nparts);
+
+/// ht_pool_new starts a pool of worker threads for ht_for_each_parallel, the threads wait between scans,
+/// so a pool made once serves any number of scans without starting threads again.
+/// The thread calling ht_for_each_parallel is worker 0, the pool starts workers - 1 threads.
+/// If threads cannot be started the pool runs with the ones that did.
+/// Returns NULL if the pool cannot be allocated.
+///
+/// workers - number of threads scanning a table, including the calling one.
+ht_Pool *ht_pool_new(size_t workers);
+
+/// ht_pool_free stops and joins the threads of the pool and frees it.
+void ht_pool_free(ht_Pool *pool);
+
+/// ht_for_each_parallel calls the function for every entity of the table from the threads of the pool.
+/// The table is split into more ranges than workers, the workers take the next free range when done,
+/// so ranges of uneven occupancy do not leave workers idle. The calling thread is worker 0.
+/// A pool runs one scan at a time, calls sharing a pool must not overlap.
+/// Returns 0 on success or error value otherwise.
+///
+/// ht - pointer to the hash table, it must not be changed during the scan.
+/// pool - worker threads made with ht_pool_new.
+/// fn - called once per entity, concurrently from the workers.
+/// ctx - passed to the function.
+int ht_for_each_parallel(HT *ht, ht_Pool *pool, ht_VisitFunction fn, void *ctx);
+
 /// ht_next allows to iterate over key values pairs.
+/// During an incremental migration the iterator migrates the old buckets that map to the bucket it reaches,
+/// so the migration work is spread over the iteration and the entities behind the iterator do not move.
 /// Returns pointer to the next Entity of key value pair or NULL if iterator is exhausted.
+/// Entities live inside the table, the pointer is valid until the next call on the table,
+/// advancing the same iterator with ht_next or ht_next_batch does not move the entities it has passed.
 ///
 /// ht - pointer to the hash table.
 /// it - pointer to new iterator.
 Entity *ht_next(HT *ht, Iterator *it);
 
+/// ht_next_batch fills out with up to max entities following the iterator position, as ht_next would return them.
+/// The chained engine prefetches the entity arrays of the buckets ahead of the one it reads,
+/// so scans exporting the whole table wait less on the scattered arrays, the slot engines scan their slots,
+/// control bytes or tags in one pass and prefetch the lines ahead of it. It may be mixed with ht_next calls.
+/// Returns the number of entities written to out, 0 when the iterator is exhausted.
+/// Entities live inside the table, the pointers are valid until the next call on the table,
+/// advancing the same iterator with ht_next or ht_next_batch does not move the entities it has passed.
+///
+/// ht - pointer to the hash table.
+/// it - pointer to the iterator.
+/// out - array of at least max entity pointers.
+/// max - number of entities to return at most.
+size_t ht_next_batch(HT *ht, Iterator *it, Entity *out[], size_t max);
+
 /// ht_free frees the memory allocated for the hash table.
 /// It is a caller responsibility to free underlining values.
 ///
@@ -0,0 +1,377 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "ht.h"
+#include "ht_engine.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Bucketized cuckoo hashing keeps every entity in one of two 4-way buckets of a flat slot array,
+// the first chosen by the table hash and the second by the same hash remixed with a seed,
+// so a lookup never scans more than two buckets and moving an entity never reads its key.
+// In front of the slots the ctrl array keeps a tag byte per slot, 0 for an empty slot,
+// so the tags of 16 buckets share a cache line and a lookup reads the entities of matching tags only.
+// An insertion into two full buckets searches breadth first for a short path of entities
+// to move to their other bucket. When no path exists the key goes to a stash of at most
+// CuckooStashMax entities that is scanned last, and once the stash is full the table grows.
+// Keys sharing their full hash with both buckets are stashed past the limit,
+// no table size separates them.
+
+#define CuckooWays 4
+#define CuckooMaxPath 5
+#define CuckooMaxNodes 256
+#define CuckooStashMax 4
+#define CuckooSeed 0x5851F42D4C957F2Dull
+#define CuckooMaxLoadFactor 0.9
+#define CuckooMaxLoadLimit 0.95
+#define CacheLine 64
+
+static inline size_t firstBucket(unsigned long h, size_t buckets) {
+    return bucketIndex(h, buckets);
+}
+
+// altSeed keys the remix of the second bucket with the table seed, so seeded tables hide both buckets of a key.
+static inline uint64_t altSeed(const HT *ht) {
+    return CuckooSeed ^ ht->seed.k1;
+}
+
+// secondBucket takes the top bits of the remixed hash, which are independent of the bits
+// bucketIndex takes from the golden ratio product. Keys with equal hashes share both buckets.
+static inline size_t secondBucket(unsigned long h, uint64_t seed, size_t first, size_t buckets) {
+    size_t b = (size_t)(finalMix((uint64_t)h ^ seed) >> (64 - capBits(buckets)));
+    return b != first ? b : (first + 1) & (buckets - 1);
+}
+
+// otherBucket reads only the cached hash of the entity.
+static inline size_t otherBucket(const Entity *en, uint64_t seed, size_t bucket, size_t buckets) {
+    size_t first = firstBucket(en->hash, buckets);
+    return bucket != first ? first : secondBucket(en->hash, seed, first, buckets);
+}
+
+// slotTag takes the 8 bits of the mixed hash below the first bucket index, entities of a bucket
+// share the index bits and differ in these. The tag does not depend on the bucket the entity is in.
+static inline unsigned char slotTag(unsigned long h, size_t buckets) {
+    unsigned char tag = (unsigned char)(mixHash(h) >> (56 - capBits(buckets)));
+    return tag ? tag : 1;
+}
+
+static Entity *scanBucket(HT *ht, size_t bucket, unsigned char tag, const unsigned char *key, size_t len, unsigned long h) {
+    const unsigned char *tags = &ht->ctrl[bucket*CuckooWays];
+    for (unsigned w = 0; w < CuckooWays; w++) {
+        if (tags[w] == tag && sameKey(&ht->slots[bucket*CuckooWays + w], key, len, h)) {
+            return &ht->slots[bucket*CuckooWays + w];
+        }
+    }
+    return NULL;
+}
+
+// PathNode is a bucket reached by moving the entity of the parent's way to its other bucket.
+typedef struct {
+    size_t bucket;
+    int parent;
+    unsigned way;
+    unsigned depth;
+} PathNode;
+
+static int onPath(const PathNode *nodes, int n, size_t bucket) {
+    for (; n >= 0; n = nodes[n].parent) {
+        if (nodes[n].bucket == bucket) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// place stores the entity in one of its buckets, moving other entities along the shortest path found.
+// The search reads the tags to find empty slots and the cached hashes to find the other buckets.
+// Returns the slot the entity landed in or NULL if no path exists.
+static Entity *place(Entity *slots, unsigned char *tags, size_t buckets, uint64_t seed, Entity en, size_t first, size_t second) {
+    PathNode nodes[CuckooMaxNodes];
+    int head = 0;
+    int tail = 0;
+    nodes[tail++] = (PathNode){.bucket = first, .parent = -1, .way = 0, .depth = 0};
+    nodes[tail++] = (PathNode){.bucket = second, .parent = -1, .way = 0, .depth = 0};
+
+    while (head < tail) {
+        int n = head++;
+        size_t base = nodes[n].bucket*CuckooWays;
+        for (unsigned w = 0; w < CuckooWays; w++) {
+            if (tags[base + w]) {
+                continue;
+            }
+            size_t dst = base + w;
+            for (; nodes[n].parent >= 0; n = nodes[n].parent) {
+                size_t src = nodes[nodes[n].parent].bucket*CuckooWays + nodes[n].way;
+                slots[dst] = slots[src];
+                tags[dst] = tags[src];
+                dst = src;
+            }
+            slots[dst] = en;
+            tags[dst] = slotTag(en.hash, buckets);
+            return &slots[dst];
+        }
+        if (nodes[n].depth == CuckooMaxPath) {
+            continue;
+        }
+        for (unsigned w = 0; w < CuckooWays && tail < CuckooMaxNodes; w++) {
+            size_t other = otherBucket(&slots[base + w], seed, nodes[n].bucket, buckets);
+            if (onPath(nodes, n, other)) {
+                continue;
+            }
+            nodes[tail++] = (PathNode){.bucket = other, .parent = n, .way = w, .depth = nodes[n].depth + 1};
+        }
+    }
+    return NULL;
+}
+
+// inseparable tells that every entity of both full buckets has the hash h,
+// so the key and the entities have the same two buckets in a table of any size.
+static int inseparable(const Entity *slots, unsigned long h, size_t first, size_t second) {
+    for (unsigned w = 0; w < CuckooWays; w++) {
+        if (slots[first*CuckooWays + w].hash != h || slots[second*CuckooWays + w].hash != h) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// cuckooAlloc allocates the slots and the zeroed tags aligned to cache lines,
+// so a bucket of tags never straddles two lines and a bucket of slots spans exactly two.
+static int cuckooAlloc(size_t cap, Entity **slots, unsigned char **tags) {
+    void *s = NULL;
+    void *t = NULL;
+    if (posix_memalign(&s, CacheLine, cap*sizeof(Entity)) != 0 || posix_memalign(&t, CacheLine, cap) != 0) {
+        free(s);
+        return ht_ErrCannotInsert;
+    }
+    memset(t, 0, cap);
+    *slots = s;
+    *tags = t;
+    return 0;
+}
+
+static int cuckooInit(HT *ht, size_t cap) {
+    if (cap < 2*CuckooWays) {
+        cap = 2*CuckooWays;
+    }
+    ht->cap = cap;
+    return cuckooAlloc(cap, &ht->slots, &ht->ctrl);
+}
+
+static void cuckooRelease(HT *ht) {
+    free(ht->slots);
+    free(ht->ctrl);
+    free(ht->stash.arr);
+    ht->slots = NULL;
+    ht->ctrl = NULL;
+    memset(&ht->stash, 0, sizeof(Entities));
+}
+
+static int cuckooResize(HT *ht, size_t cap) {
+    if (cap < 2*CuckooWays || cap < ht->len) {
+        return ht_ErrCannotInsert;
+    }
+    Entity *slots = NULL;
+    unsigned char *tags = NULL;
+    if (cuckooAlloc(cap, &slots, &tags) != 0) {
+        return ht_ErrCannotInsert;
+    }
+    Entities stash = ht->stash;
+    Entity *old = ht->slots;
+    unsigned char *old_tags = ht->ctrl;
+    size_t old_cap = ht->cap;
+    size_t buckets = cap/CuckooWays;
+
+    memset(&ht->stash, 0, sizeof(Entities));
+    ht->slots = slots;
+    ht->ctrl = tags;
+    ht->cap = cap;
+    for (size_t i = 0; i < old_cap + stash.len; i++) {
+        if (i < old_cap && !old_tags[i]) {
+            continue;
+        }
+        Entity *en = i < old_cap ? &old[i] : &stash.arr[i - old_cap];
+        size_t first = firstBucket(en->hash, buckets);
+        size_t second = secondBucket(en->hash, altSeed(ht), first, buckets);
+        if (!place(slots, tags, buckets, altSeed(ht), *en, first, second) && !pushEntity(&ht->stash, *en)) {
+            free(ht->stash.arr);
+            free(slots);
+            free(tags);
+            ht->slots = old;
+            ht->ctrl = old_tags;
+            ht->cap = old_cap;
+            ht->stash = stash;
+            return ht_ErrCannotInsert;
+        }
+    }
+    free(old);
+    free(old_tags);
+    free(stash.arr);
+    setThresholds(ht);
+    return 0;
+}
+
+static Entity *cuckooFind(HT *ht, const unsigned char *key, size_t len, unsigned long h) {
+    size_t buckets = ht->cap/CuckooWays;
+    size_t first = firstBucket(h, buckets);
+    unsigned char tag = slotTag(h, buckets);
+    Entity *en = scanBucket(ht, first, tag, key, len, h);
+    if (en) {
+        return en;
+    }
+    en = scanBucket(ht, secondBucket(h, altSeed(ht), first, buckets), tag, key, len, h);
+    if (en || ht->stash.len == 0) {
+        return en;
+    }
+    for (size_t i = 0; i < ht->stash.len; i++) {
+        if (sameKey(&ht->stash.arr[i], key, len, h)) {
+            return &ht->stash.arr[i];
+        }
+    }
+    return NULL;
+}
+
+// cuckooClaim grows the table until the key finds a path or a place in the stash,
+// every growth moves the stashed entities back to the slots.
+static Entity *cuckooClaim(HT *ht, const unsigned char *key, size_t len, unsigned long h) {
+    Entity carry = {
+        .key = (unsigned char*)key,
+        .value = NULL,
+        .hash = h,
+        .key_len = len,
+    };
+    for (;;) {
+        size_t buckets = ht->cap/CuckooWays;
+        size_t first = firstBucket(h, buckets);
+        size_t second = secondBucket(h, altSeed(ht), first, buckets);
+        Entity *en = place(ht->slots, ht->ctrl, buckets, altSeed(ht), carry, first, second);
+        if (en) {
+            return en;
+        }
+        if (ht->stash.len < CuckooStashMax || inseparable(ht->slots, h, first, second)) {
+            return pushEntity(&ht->stash, carry);
+        }
+        if (cuckooResize(ht, ht->cap*2) != 0) {
+            return NULL;
+        }
+    }
+}
+
+static Entity *cuckooInsert(HT *ht, const unsigned char *key, size_t len, unsigned long h, int *inserted) {
+    Entity *en = cuckooFind(ht, key, len, h);
+    *inserted = 0;
+    if (en) {
+        return en;
+    }
+    en = cuckooClaim(ht, key, len, h);
+    *inserted = en != NULL;
+    return en;
+}
+
+static int cuckooRemove(HT *ht, const unsigned char *key, size_t len, unsigned long h, void **value) {
+    Entity *en = cuckooFind(ht, key, len, h);
+    if (!en) {
+        return 0;
+    }
+    *value = en->value;
+    if (en >= ht->slots && en < ht->slots + ht->cap) {
+        ht->ctrl[en - ht->slots] = 0;
+    } else {
+        *en = ht->stash.arr[--ht->stash.len];
+    }
+    return 1;
+}
+
+static size_t cuckooRetain(HT *ht, ht_RetainFunction pred, void *ctx) {
+    size_t removed = 0;
+    for (size_t i = 0; i < ht->cap; i++) {
+        if (ht->ctrl[i] && !pred(&ht->slots[i], ctx)) {
+            ht->ctrl[i] = 0;
+            removed++;
+        }
+    }
+    return removed + retainEntities(&ht->stash, pred, ctx);
+}
+
+static Entity *cuckooNext(HT *ht, Iterator *it) {
+    size_t end = iterEnd(ht, it);
+    for (size_t i = it->hash_table_idx; i < end; i++) {
+        if (ht->ctrl[i]) {
+            it->hash_table_idx = i + 1;
+            return &ht->slots[i];
+        }
+    }
+    if (it->end_idx <= ht->cap) {
+        it->hash_table_idx = end;
+        return NULL;
+    }
+    size_t s = it->hash_table_idx > ht->cap ? it->hash_table_idx - ht->cap : 0;
+    if (s < ht->stash.len) {
+        it->hash_table_idx = ht->cap + s + 1;
+        return &ht->stash.arr[s];
+    }
+    it->hash_table_idx = ht->cap + ht->stash.len;
+    return NULL;
+}
+
+// cuckooNextBatch reads the tags in one pass and touches only the slots they mark,
+// prefetching the lines ahead of the scan, then the stash.
+static size_t cuckooNextBatch(HT *ht, Iterator *it, Entity *out[], size_t max) {
+    size_t end = iterEnd(ht, it);
+    size_t i = it->hash_table_idx;
+    size_t n = 0;
+    for (; i < end && n < max; i++) {
+        prefetchScan(ht->slots, i, end);
+        if (ht->ctrl[i]) {
+            out[n++] = &ht->slots[i];
+        }
+    }
+    it->hash_table_idx = i;
+    if (i < end) {
+        return n;
+    }
+    return stashNextBatch(ht, it, out, n, max);
+}
+
+// cuckooPrefetch loads the tags of both buckets, then the slots with a matching tag,
+// then the key of the slot with the hash.
+static void cuckooPrefetch(const HT *ht, unsigned long h, unsigned stage) {
+    size_t buckets = ht->cap/CuckooWays;
+    size_t first = firstBucket(h, buckets);
+    size_t bucket[2] = {first, secondBucket(h, altSeed(ht), first, buckets)};
+    if (stage == 0) {
+        prefetchRead(&ht->ctrl[bucket[0]*CuckooWays]);
+        prefetchRead(&ht->ctrl[bucket[1]*CuckooWays]);
+        return;
+    }
+    unsigned char tag = slotTag(h, buckets);
+    for (unsigned b = 0; b < 2; b++) {
+        for (unsigned w = 0; w < CuckooWays; w++) {
+            size_t i = bucket[b]*CuckooWays + w;
+            if (ht->ctrl[i] != tag) {
+                continue;
+            }
+            if (stage == 1) {
+                prefetchRead(&ht->slots[i]);
+            } else if (ht->slots[i].hash == h) {
+                prefetchRead(ht->slots[i].key);
+                return;
+            }
+        }
+    }
+}
+
+const EngineOps ht_cuckooEngine = {
+    .default_max_load = CuckooMaxLoadFactor,
+    .max_load_limit = CuckooMaxLoadLimit,
+    .init = cuckooInit,
+    .release = cuckooRelease,
+    .resize = cuckooResize,
+    .find = cuckooFind,
+    .insert = cuckooInsert,
+    .claim = cuckooClaim,
+    .remove = cuckooRemove,
+    .retain = cuckooRetain,
+    .next = cuckooNext,
+    .nextBatch = cuckooNextBatch,
+    .prefetch = cuckooPrefetch,
+};
@@ -0,0 +1,214 @@
+#ifndef ht_engine_H
+#define ht_engine_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ht.h"
+
+#define GoldenRatio 0x9E3779B97F4A7C15ull
+
+/// PrefetchStages is the number of dependent loads a find does before comparing key bytes,
+/// e.g. bucket header, entities and key for the chained engine.
+#define PrefetchStages 3
+
+#if defined(__GNUC__)
+#define prefetchRead(p) __builtin_prefetch((p), 0, 3)
+#else
+#define prefetchRead(p) ((void)(p))
+#endif
+
+/// EngineOps is the storage layout behind the HT operations.
+/// Each engine owns the table arrays, the generic layer in ht.c owns hashing,
+/// len bookkeeping and the load factor driven growth and shrinking.
+typedef struct {
+    /// Default max load factor of the engine, and the upper limit accepted by ht_setLoadFactor (0 for none).
+    double default_max_load;
+    double max_load_limit;
+
+    /// init allocates an empty table of cap slots or buckets.
+    int (*init)(HT *ht, size_t cap);
+
+    /// release frees the table arrays.
+    void (*release)(HT *ht);
+
+    /// resize moves all entities to a table of new capacity.
+    int (*resize)(HT *ht, size_t cap);
+
+    /// find returns the entity of the key or NULL.
+    Entity *(*find)(HT *ht, const unsigned char *key, size_t len, unsigned long h);
+
+    /// insert returns the entity of the key, claiming a new one with key, length and hash set if it is absent.
+    /// The caller sets the value. Returns NULL if no entity can be claimed.
+    Entity *(*insert)(HT *ht, const unsigned char *key, size_t len, unsigned long h, int *inserted);
+
+    /// claim is insert for a key the caller guarantees is absent, it compares no keys.
+    /// Returns the new entity with key, length and hash set or NULL if no entity can be claimed.
+    Entity *(*claim)(HT *ht, const unsigned char *key, size_t len, unsigned long h);
+
+    /// load inserts n keys with their hashes and values into a table already sized for them,
+    /// unique tells that the keys are distinct and absent. Sets inserted to the number of new entities.
+    /// Returns 0 on success or ht_ErrCannotInsert. May be NULL, the keys are inserted one by one then.
+    int (*load)(HT *ht, const unsigned char *const keys[], const size_t lens[], const unsigned long hashes[],
+                void *const values[], size_t n, int unique, size_t *inserted);
+
+    /// remove deletes the entity of the key and passes its value.
+    /// Returns 1 if the key was found, 0 otherwise.
+    int (*remove)(HT *ht, const unsigned char *key, size_t len, unsigned long h, void **value);
+
+    /// retain removes the entities the predicate rejects in one pass. Returns the number removed.
+    size_t (*retain)(HT *ht, ht_RetainFunction pred, void *ctx);
+
+    /// next returns the entity after the iterator position or NULL.
+    Entity *(*next)(HT *ht, Iterator *it);
+
+    /// nextBatch fills out with up to max entities after the iterator position and returns their number.
+    /// May be NULL, next is called per entity then.
+    size_t (*nextBatch)(HT *ht, Iterator *it, Entity *out[], size_t max);
+
+    /// prefetch starts loading the memory a find of the hash reads at the given stage, from 0 to PrefetchStages - 1.
+    /// A stage reaches what the memory of the previous stage points at, so batched operations
+    /// run each stage over all their keys before the next one and the cache misses of the keys overlap.
+    void (*prefetch)(const HT *ht, unsigned long h, unsigned stage);
+} EngineOps;
+
+extern const EngineOps ht_swissEngine;
+extern const EngineOps ht_robinHoodEngine;
+extern const EngineOps ht_cuckooEngine;
+extern const EngineOps ht_hopscotchEngine;
+
+static inline unsigned lowestBit(unsigned long long x) {
+#if defined(__GNUC__)
+    return (unsigned)__builtin_ctzll(x);
+#else
+    unsigned bit = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+static inline unsigned capBits(size_t cap) {
+    return lowestBit((unsigned long long)cap);
+}
+
+static inline size_t roundUpPow2(size_t cap) {
+    size_t pow2 = 1;
+    while (pow2 < cap) {
+        pow2 <<= 1;
+    }
+    return pow2;
+}
+
+/// loadWord reads 8 bytes of a key in the native byte order, at any alignment.
+static inline uint64_t loadWord(const unsigned char *p) {
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+/// loadHalf reads 4 bytes of a key in the native byte order, at any alignment.
+static inline uint64_t loadHalf(const unsigned char *p) {
+    uint32_t w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+/// finalMix is the fmix64 finalizer of MurmurHash3,
+/// each input bit flips every output bit with a probability close to 1/2.
+static inline uint64_t finalMix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+/// mixHash multiplies the hash by 2^64/phi, spreading every bit of the hash to the top bits.
+static inline uint64_t mixHash(unsigned long h) {
+    return (uint64_t)h*GoldenRatio;
+}
+
+/// bucketIndex selects the bucket of a power of two capacity table.
+/// The top bits of the mixed hash are taken as the index,
+/// so weak low bits of the hash do not cluster and no division is needed.
+static inline size_t bucketIndex(unsigned long h, size_t cap) {
+    return (size_t)(mixHash(h) >> (64 - capBits(cap)));
+}
+
+/// sameKey compares the cached hashes and lengths first, so the key memory is only touched for likely matches.
+static inline int sameKey(const Entity *en, const unsigned char *key, size_t len, unsigned long h) {
+    return en->hash == h && en->key_len == len && memcmp(key, en->key, len) == 0;
+}
+
+/// pushEntity appends the entity to the array, doubling it when full,
+/// it grows the chains of the chained engine and the stash of the cuckoo and hopscotch engines.
+/// Returns the stored entity or NULL if the array cannot grow.
+static inline Entity *pushEntity(Entities *ens, Entity en) {
+    if (ens->len == ens->cap) {
+        size_t cap = ens->cap ? ens->cap*2 : 2;
+        Entity *arr = realloc(ens->arr, cap*sizeof(Entity));
+        if (!arr) {
+            return NULL;
+        }
+        ens->arr = arr;
+        ens->cap = cap;
+    }
+    ens->arr[ens->len] = en;
+    return &ens->arr[ens->len++];
+}
+
+/// retainEntities compacts the entity array in place, keeping the order of the entities the predicate keeps.
+static inline size_t retainEntities(Entities *ens, ht_RetainFunction pred, void *ctx) {
+    size_t kept = 0;
+    for (size_t i = 0; i < ens->len; i++) {
+        if (pred(&ens->arr[i], ctx)) {
+            ens->arr[kept++] = ens->arr[i];
+        }
+    }
+    size_t removed = ens->len - kept;
+    ens->len = kept;
+    return removed;
+}
+
+/// iterEnd is the end of the slots or buckets the iterator visits.
+static inline size_t iterEnd(const HT *ht, const Iterator *it) {
+    return it->end_idx < ht->cap ? it->end_idx : ht->cap;
+}
+
+/// ScanAhead is how many slots past the one read the nextBatch of the slot engines prefetches,
+/// SlotsPerLine how many slots share a cache line, the scan prefetches once per line.
+#define ScanAhead 32
+#define SlotsPerLine (64/sizeof(Entity))
+
+/// prefetchScan prefetches the slot ScanAhead past slot i of a scan stopping at end, once per cache line.
+static inline void prefetchScan(const Entity *slots, size_t i, size_t end) {
+    if (i%SlotsPerLine == 0 && i + ScanAhead < end) {
+        prefetchRead(&slots[i + ScanAhead]);
+    }
+}
+
+/// stashNextBatch continues a batch past the slots into the stash of the cuckoo and hopscotch engines,
+/// which the iterator visits at the positions from cap on when it ends past the slots.
+/// It takes the n entities already in out and returns their number with the stashed ones added.
+static inline size_t stashNextBatch(HT *ht, Iterator *it, Entity *out[], size_t n, size_t max) {
+    if (it->end_idx <= ht->cap) {
+        return n;
+    }
+    size_t s = it->hash_table_idx > ht->cap ? it->hash_table_idx - ht->cap : 0;
+    for (; s < ht->stash.len && n < max; s++) {
+        out[n++] = &ht->stash.arr[s];
+    }
+    it->hash_table_idx = ht->cap + s;
+    return n;
+}
+
+static inline void setThresholds(HT *ht) {
+    ht->grow_at = (size_t)(ht->max_load*(double)ht->cap);
+    ht->shrink_at = (size_t)(ht->min_load*(double)ht->cap);
+}
+
+#endif
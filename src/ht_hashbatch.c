@@ -0,0 +1,261 @@
+#include "ht.h"
+#include "ht_engine.h"
+#include <stdint.h>
+#include <string.h>
+
+// ht_hash_batch hashes groups of eight keys at once, one key per 64 bit vector lane.
+// The byte at a time hashes are a serial chain of shifts and adds per key,
+// so running the chains of independent keys side by side hides their latency.
+// Every lane takes 8 bytes of its key per step, and the steps past the shortest key of the group
+// are masked per lane, which keeps the results equal to the scalar functions.
+// AVX2 is enabled per function and selected at run time, NEON is the aarch64 baseline.
+// Hash functions without a vector kernel, and the keys left over, are hashed one by one,
+// which includes ht_HashLLN, its scalar form already sums 8 bytes per step.
+
+#define BatchGroup 8
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define HashBatchAVX2
+#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_NEON) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define HashBatchNEON
+#include <arm_neon.h>
+#endif
+
+#if defined(HashBatchAVX2) || defined(HashBatchNEON)
+
+typedef enum {
+    BatchDJB2,
+    BatchSDBM,
+} BatchKind;
+
+static int batchKind(ht_HashFunctionN f, BatchKind *kind) {
+    if (f == ht_HashDJB2N) {
+        *kind = BatchDJB2;
+        return 1;
+    }
+    if (f == ht_HashSDBMN) {
+        *kind = BatchSDBM;
+        return 1;
+    }
+    return 0;
+}
+
+// laneWord reads the 8 bytes of the key at pos, zero padded past the key end.
+// Bytes are laid out from the lowest, as on the little endian CPUs the kernels run on.
+// Tails are read with overlapping loads inside the key, so no byte past the key is touched.
+// Keys of 8 bytes and more take no branch, key lengths in a group are rarely alike to predict one.
+static inline uint64_t laneWord(const unsigned char *key, size_t len, size_t pos) {
+    if (len >= 8) {
+        size_t start = pos < len - 8 ? pos : len - 8;
+        uint64_t live = (uint64_t)0 - (pos < len);
+        return (loadWord(key + start) >> (8*((pos - start) & 7))) & live;
+    }
+    if (pos >= len) {
+        return 0;
+    }
+    size_t n = len - pos;
+    if (n >= 4) {
+        return loadHalf(key) | loadHalf(key + n - 4) << (8*(n - 4));
+    }
+    return (uint64_t)key[0] | (uint64_t)key[n >> 1] << (8*(n >> 1)) | (uint64_t)key[n - 1] << (8*(n - 1));
+}
+
+static inline void groupWords(const void *const *keys, const size_t *lens, size_t pos, uint64_t *words) {
+    for (unsigned l = 0; l < BatchGroup; l++) {
+        words[l] = laneWord(keys[l], lens[l], pos);
+    }
+}
+
+static inline void groupBounds(const size_t *lens, size_t *shortest, size_t *longest) {
+    *shortest = lens[0];
+    *longest = lens[0];
+    for (unsigned l = 1; l < BatchGroup; l++) {
+        if (lens[l] < *shortest) {
+            *shortest = lens[l];
+        }
+        if (lens[l] > *longest) {
+            *longest = lens[l];
+        }
+    }
+}
+
+static inline uint64_t batchSeed(BatchKind kind) {
+    return kind == BatchDJB2 ? 5381 : 0;
+}
+
+#endif
+
+#if defined(HashBatchAVX2)
+
+__attribute__((target("avx2"), always_inline))
+static inline __m256i stepAVX2(BatchKind kind, __m256i h, __m256i b) {
+    if (kind == BatchDJB2) {
+        return _mm256_add_epi64(_mm256_add_epi64(_mm256_slli_epi64(h, 5), h), b);
+    }
+    return _mm256_sub_epi64(_mm256_add_epi64(_mm256_add_epi64(b, _mm256_slli_epi64(h, 6)), _mm256_slli_epi64(h, 16)), h);
+}
+
+// hashGroupAVX2 runs the group in two vectors, the words every lane takes in full are not masked.
+// Bytes are taken from the bottom of the words, shifting them down by one byte per step.
+__attribute__((target("avx2"), always_inline))
+static inline void hashGroupAVX2(BatchKind kind, const void *const *keys, const size_t *lens, unsigned long *out) {
+    size_t shortest, longest;
+    groupBounds(lens, &shortest, &longest);
+    const __m256i low_byte = _mm256_set1_epi64x(0xFF);
+    const __m256i one = _mm256_set1_epi64x(1);
+    uint64_t w[BatchGroup];
+    for (unsigned l = 0; l < BatchGroup; l++) {
+        w[l] = lens[l];
+    }
+    __m256i len0 = _mm256_loadu_si256((const __m256i*)&w[0]);
+    __m256i len1 = _mm256_loadu_si256((const __m256i*)&w[4]);
+    __m256i h0 = _mm256_set1_epi64x((long long)batchSeed(kind));
+    __m256i h1 = h0;
+    size_t pos = 0;
+    for (; pos + 8 <= shortest; pos += 8) {
+        groupWords(keys, lens, pos, w);
+        __m256i w0 = _mm256_loadu_si256((const __m256i*)&w[0]);
+        __m256i w1 = _mm256_loadu_si256((const __m256i*)&w[4]);
+        for (unsigned k = 0; k < 8; k++) {
+            h0 = stepAVX2(kind, h0, _mm256_and_si256(w0, low_byte));
+            h1 = stepAVX2(kind, h1, _mm256_and_si256(w1, low_byte));
+            w0 = _mm256_srli_epi64(w0, 8);
+            w1 = _mm256_srli_epi64(w1, 8);
+        }
+    }
+    for (; pos < longest; pos += 8) {
+        groupWords(keys, lens, pos, w);
+        __m256i w0 = _mm256_loadu_si256((const __m256i*)&w[0]);
+        __m256i w1 = _mm256_loadu_si256((const __m256i*)&w[4]);
+        __m256i at = _mm256_set1_epi64x((long long)pos);
+        for (unsigned k = 0; k < 8; k++) {
+            __m256i next0 = stepAVX2(kind, h0, _mm256_and_si256(w0, low_byte));
+            __m256i next1 = stepAVX2(kind, h1, _mm256_and_si256(w1, low_byte));
+            h0 = _mm256_blendv_epi8(h0, next0, _mm256_cmpgt_epi64(len0, at));
+            h1 = _mm256_blendv_epi8(h1, next1, _mm256_cmpgt_epi64(len1, at));
+            w0 = _mm256_srli_epi64(w0, 8);
+            w1 = _mm256_srli_epi64(w1, 8);
+            at = _mm256_add_epi64(at, one);
+        }
+    }
+    _mm256_storeu_si256((__m256i*)&w[0], h0);
+    _mm256_storeu_si256((__m256i*)&w[4], h1);
+    for (unsigned l = 0; l < BatchGroup; l++) {
+        out[l] = (unsigned long)w[l];
+    }
+}
+
+// The kernel is instantiated per hash function, so the step of the function is inlined into it.
+__attribute__((target("avx2")))
+static void hashBatchAVX2(BatchKind kind, const void *const *keys, const size_t *lens, unsigned long *out, size_t n) {
+    if (kind == BatchDJB2) {
+        for (size_t i = 0; i + BatchGroup <= n; i += BatchGroup) {
+            hashGroupAVX2(BatchDJB2, &keys[i], &lens[i], &out[i]);
+        }
+        return;
+    }
+    for (size_t i = 0; i + BatchGroup <= n; i += BatchGroup) {
+        hashGroupAVX2(BatchSDBM, &keys[i], &lens[i], &out[i]);
+    }
+}
+
+// avx2Supported is set by a constructor before main, so threads only ever read it.
+// Batches hashed before it runs take the scalar path, which gives the same hashes.
+static int avx2Supported;
+
+__attribute__((constructor))
+static void checkAVX2(void) {
+    __builtin_cpu_init();
+    avx2Supported = __builtin_cpu_supports("avx2");
+}
+
+static int hasVectorKernel(void) {
+    return avx2Supported;
+}
+
+#define hashBatchVector hashBatchAVX2
+
+#elif defined(HashBatchNEON)
+
+// stepNEON advances two lanes of the hash by one byte each.
+static inline uint64x2_t stepNEON(BatchKind kind, uint64x2_t h, uint64x2_t b) {
+    if (kind == BatchDJB2) {
+        return vaddq_u64(vaddq_u64(vshlq_n_u64(h, 5), h), b);
+    }
+    return vsubq_u64(vaddq_u64(vaddq_u64(b, vshlq_n_u64(h, 6)), vshlq_n_u64(h, 16)), h);
+}
+
+// hashGroupNEON runs the group in four vectors of two lanes, masking only the words where keys end.
+__attribute__((always_inline))
+static inline void hashGroupNEON(BatchKind kind, const void *const *keys, const size_t *lens, unsigned long *out) {
+    size_t shortest, longest;
+    groupBounds(lens, &shortest, &longest);
+    const uint64x2_t low_byte = vdupq_n_u64(0xFF);
+    uint64_t w[BatchGroup];
+    for (unsigned l = 0; l < BatchGroup; l++) {
+        w[l] = lens[l];
+    }
+    uint64x2_t len[4];
+    uint64x2_t h[4];
+    for (unsigned v = 0; v < 4; v++) {
+        len[v] = vld1q_u64(&w[2*v]);
+        h[v] = vdupq_n_u64(batchSeed(kind));
+    }
+    for (size_t pos = 0; pos < longest; pos += 8) {
+        groupWords(keys, lens, pos, w);
+        uint64x2_t words[4];
+        for (unsigned v = 0; v < 4; v++) {
+            words[v] = vld1q_u64(&w[2*v]);
+        }
+        int masked = pos + 8 > shortest;
+        for (unsigned k = 0; k < 8; k++) {
+            uint64x2_t at = vdupq_n_u64(pos + k);
+            for (unsigned v = 0; v < 4; v++) {
+                uint64x2_t next = stepNEON(kind, h[v], vandq_u64(words[v], low_byte));
+                h[v] = masked ? vbslq_u64(vcgtq_u64(len[v], at), next, h[v]) : next;
+                words[v] = vshrq_n_u64(words[v], 8);
+            }
+        }
+    }
+    for (unsigned v = 0; v < 4; v++) {
+        vst1q_u64(&w[2*v], h[v]);
+    }
+    for (unsigned l = 0; l < BatchGroup; l++) {
+        out[l] = (unsigned long)w[l];
+    }
+}
+
+static void hashBatchNEON(BatchKind kind, const void *const *keys, const size_t *lens, unsigned long *out, size_t n) {
+    if (kind == BatchDJB2) {
+        for (size_t i = 0; i + BatchGroup <= n; i += BatchGroup) {
+            hashGroupNEON(BatchDJB2, &keys[i], &lens[i], &out[i]);
+        }
+        return;
+    }
+    for (size_t i = 0; i + BatchGroup <= n; i += BatchGroup) {
+        hashGroupNEON(BatchSDBM, &keys[i], &lens[i], &out[i]);
+    }
+}
+
+static int hasVectorKernel(void) {
+    return 1;
+}
+
+#define hashBatchVector hashBatchNEON
+
+#endif
+
+void ht_hash_batch(ht_HashFunctionN f, const void *const keys[], const size_t lens[], unsigned long out_hashes[], size_t n) {
+    size_t i = 0;
+#if defined(HashBatchAVX2) || defined(HashBatchNEON)
+    BatchKind kind;
+    if (batchKind(f, &kind) && hasVectorKernel()) {
+        hashBatchVector(kind, keys, lens, out_hashes, n);
+        i = n - n%BatchGroup;
+    }
+#endif
+    for (; i < n; i++) {
+        out_hashes[i] = f(keys[i], lens[i]);
+    }
+}
@@ -0,0 +1,158 @@
+#include "ht.h"
+#include "ht_engine.h"
+#include <stdint.h>
+#include <string.h>
+
+// ht_HashHW hashes with the CRC32C or AES instructions of the CPU it runs on.
+// The instructions are enabled per function with target attributes, so the library builds
+// for the baseline of the architecture, and the implementation is picked once at load time
+// from CPUID on x86-64 and from the hardware capabilities on ARMv8 Linux.
+// Other CPUs and compilers fall back to ht_HashWYN.
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define HashHWX86
+#include <cpuid.h>
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#define CrcTarget __attribute__((target("sse4.2")))
+#define crcWord(c, w) _mm_crc32_u64((c), (w))
+#elif defined(__GNUC__) && defined(__aarch64__) && (defined(__ARM_FEATURE_CRC32) || defined(__linux__))
+#define HashHWArm
+#include <arm_acle.h>
+#if defined(__ARM_FEATURE_CRC32)
+#define CrcTarget
+#elif defined(__clang__)
+#define CrcTarget __attribute__((target("crc")))
+#else
+#define CrcTarget __attribute__((target("+crc")))
+#endif
+#if !defined(__ARM_FEATURE_CRC32)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#define crcWord(c, w) __crc32cd((uint32_t)(c), (w))
+#endif
+
+#if defined(HashHWX86) || defined(HashHWArm)
+
+// loadShort packs a tail of 1 to 7 bytes in a word with overlapping loads instead of a byte copy.
+static inline uint64_t loadShort(const unsigned char *p, size_t n) {
+    if (n >= 4) {
+        return loadHalf(p) | loadHalf(p + n - 4) << 32;
+    }
+    return (uint64_t)p[0] | (uint64_t)p[n >> 1] << 8 | (uint64_t)p[n - 1] << 16;
+}
+
+// crcFinish joins the two 32 bit CRC lanes and mixes them, CRC alone is linear in the key bits.
+static inline uint64_t crcFinish(uint64_t c1, uint64_t c2, size_t len) {
+    return finalMix((c1 << 32 | (uint32_t)c2) ^ len);
+}
+
+// hashCRC runs two CRC32C lanes over alternating words, so the CRC unit works on both at once.
+CrcTarget
+static unsigned long hashCRC(const void *key, size_t len) {
+    const unsigned char *p = key;
+    size_t n = len;
+    uint64_t c1 = 0xFFFFFFFFu;
+    uint64_t c2 = 0x9E3779B9u ^ (uint32_t)len;
+    for (; n >= 16; n -= 16, p += 16) {
+        c1 = crcWord(c1, loadWord(p));
+        c2 = crcWord(c2, loadWord(p + 8));
+    }
+    if (n >= 8) {
+        c1 = crcWord(c1, loadWord(p));
+        p += 8;
+        n -= 8;
+    }
+    if (n > 0) {
+        c2 = crcWord(c2, loadShort(p, n));
+    }
+    return (unsigned long)crcFinish(c1, c2, len);
+}
+
+#endif
+
+#if defined(HashHWX86)
+
+// hashAES absorbs 16 byte blocks with an AES round each, in two lanes for keys over 32 bytes.
+// Three closing rounds spread every key byte over all 16 bytes of the state.
+__attribute__((target("aes")))
+static unsigned long hashAES(const void *key, size_t len) {
+    const unsigned char *p = key;
+    size_t n = len;
+    const __m128i k0 = _mm_set_epi64x((long long)0x2D358DCCAA6C78A5ull, (long long)0x8BB84B93962EACC9ull);
+    const __m128i k1 = _mm_set_epi64x((long long)0x4B33A62ED433D4A3ull, (long long)0x4D5A2DA51DE1AA47ull);
+    __m128i s0 = _mm_xor_si128(k0, _mm_set_epi64x(0, (long long)len));
+    __m128i s1 = k1;
+    for (; n > 32; n -= 32, p += 32) {
+        s0 = _mm_aesenc_si128(_mm_xor_si128(s0, _mm_loadu_si128((const __m128i*)p)), k0);
+        s1 = _mm_aesenc_si128(_mm_xor_si128(s1, _mm_loadu_si128((const __m128i*)(p + 16))), k1);
+    }
+    if (n > 16) {
+        s0 = _mm_aesenc_si128(_mm_xor_si128(s0, _mm_loadu_si128((const __m128i*)p)), k0);
+        p += 16;
+        n -= 16;
+    }
+    __m128i tail = _mm_setzero_si128();
+    if (n >= 8) {
+        tail = _mm_set_epi64x((long long)loadWord(p + n - 8), (long long)loadWord(p));
+    } else if (n > 0) {
+        tail = _mm_set_epi64x(0, (long long)loadShort(p, n));
+    }
+    s1 = _mm_aesenc_si128(_mm_xor_si128(s1, tail), k1);
+
+    __m128i s = _mm_aesenc_si128(s0, s1);
+    s = _mm_aesenc_si128(s, k0);
+    s = _mm_aesenc_si128(s, k1);
+    uint64_t halves[2];
+    _mm_storeu_si128((__m128i*)halves, s);
+    return (unsigned long)(halves[0] ^ halves[1]);
+}
+
+#endif
+
+static ht_HashFunctionN selectHW(void) {
+#if defined(HashHWX86)
+    unsigned int a, b, c, d;
+    if (__get_cpuid(1, &a, &b, &c, &d)) {
+        if (c & bit_AES) {
+            return hashAES;
+        }
+        if (c & bit_SSE4_2) {
+            return hashCRC;
+        }
+    }
+#elif defined(HashHWArm) && defined(__ARM_FEATURE_CRC32)
+    return hashCRC;
+#elif defined(HashHWArm)
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        return hashCRC;
+    }
+#endif
+    return ht_HashWYN;
+}
+
+// hwHash is selected by a constructor before main, so threads only ever read it.
+// A call made earlier, from another constructor, selects without storing.
+static ht_HashFunctionN hwHash;
+
+#if defined(__GNUC__)
+__attribute__((constructor))
+static void pickHW(void) {
+    hwHash = selectHW();
+}
+#endif
+
+unsigned long
+ht_HashHW(unsigned char *str) {
+    return ht_HashHWN(str, strlen((const char*)str));
+}
+
+unsigned long
+ht_HashHWN(const void *key, size_t len) {
+    ht_HashFunctionN f = hwHash;
+    if (!f) {
+        f = selectHW();
+    }
+    return f(key, len);
+}
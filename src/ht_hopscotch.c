@@ -0,0 +1,310 @@
+#include "ht.h"
+#include "ht_engine.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Hopscotch hashing keeps every entity within HopRange slots of its home slot.
+// Each home slot has a bitmap of the neighborhood slots holding its entities,
+// so a lookup reads one bitmap and compares only the slots it points at,
+// all of them within a few cache lines of the home slot even at high loads.
+// An insertion probes linearly for a free slot and hops it back towards the home slot
+// by moving entities that stay within their own neighborhoods. When no hop is possible the key goes
+// to a stash of at most HopStashMax entities that is scanned last, and once the stash is full the table grows.
+// Keys sharing one hash more than HopRange times are stashed past the limit, no table size separates them.
+
+#define HopRange 32
+#define HopMaxProbe 1024
+#define HopStashMax 4
+#define HopscotchMaxLoadFactor 0.9
+#define HopscotchMaxLoadLimit 0.95
+
+static inline uint32_t hopBit(size_t dist) {
+    return (uint32_t)1 << dist;
+}
+
+// hopCloser moves an entity into the free slot from a neighborhood that still covers it.
+// Returns the slot freed by the move or cap if no entity can be moved.
+static size_t hopCloser(Entity *slots, uint32_t *hops, size_t cap, size_t free_slot) {
+    size_t mask = cap - 1;
+    for (size_t back = HopRange - 1; back > 0; back--) {
+        size_t home = (free_slot - back) & mask;
+        uint32_t bits = hops[home];
+        if (!bits || lowestBit(bits) >= back) {
+            continue;
+        }
+        size_t dist = lowestBit(bits);
+        size_t src = (home + dist) & mask;
+        slots[free_slot] = slots[src];
+        hops[home] = (bits & ~hopBit(dist)) | hopBit(back);
+        memset(&slots[src], 0, sizeof(Entity));
+        return src;
+    }
+    return cap;
+}
+
+// place stores the entity in the neighborhood of its home slot.
+// Returns the slot the entity landed in or NULL if the neighborhood cannot take it.
+static Entity *place(Entity *slots, uint32_t *hops, size_t cap, Entity en) {
+    size_t mask = cap - 1;
+    size_t home = bucketIndex(en.hash, cap);
+    size_t limit = cap < HopMaxProbe ? cap : HopMaxProbe;
+    size_t dist = 0;
+    while (dist < limit && slots[(home + dist) & mask].key) {
+        dist++;
+    }
+    if (dist == limit) {
+        return NULL;
+    }
+    size_t free_slot = (home + dist) & mask;
+    while (dist >= HopRange) {
+        size_t src = hopCloser(slots, hops, cap, free_slot);
+        if (src == cap) {
+            return NULL;
+        }
+        dist -= (free_slot - src) & mask;
+        free_slot = src;
+    }
+    slots[free_slot] = en;
+    hops[home] |= hopBit(dist);
+    return &slots[free_slot];
+}
+
+// inseparable tells that the whole neighborhood of the home slot holds entities with the hash h,
+// they have the same home slot in a table of any size.
+static int inseparable(const HT *ht, unsigned long h) {
+    size_t home = bucketIndex(h, ht->cap);
+    if (ht->hops[home] != UINT32_MAX) {
+        return 0;
+    }
+    for (size_t dist = 0; dist < HopRange; dist++) {
+        if (ht->slots[(home + dist) & (ht->cap - 1)].hash != h) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int hopscotchAlloc(size_t cap, Entity **slots, uint32_t **hops) {
+    *slots = calloc(cap, sizeof(Entity));
+    *hops = calloc(cap, sizeof(uint32_t));
+    if (!*slots || !*hops) {
+        free(*slots);
+        free(*hops);
+        return ht_ErrCannotInsert;
+    }
+    return 0;
+}
+
+static int hopscotchInit(HT *ht, size_t cap) {
+    if (cap < HopRange) {
+        cap = HopRange;
+    }
+    ht->cap = cap;
+    return hopscotchAlloc(cap, &ht->slots, &ht->hops);
+}
+
+static void hopscotchRelease(HT *ht) {
+    free(ht->slots);
+    free(ht->hops);
+    free(ht->stash.arr);
+    ht->slots = NULL;
+    ht->hops = NULL;
+    memset(&ht->stash, 0, sizeof(Entities));
+}
+
+static int hopscotchResize(HT *ht, size_t cap) {
+    if (cap < HopRange || cap < ht->len) {
+        return ht_ErrCannotInsert;
+    }
+    Entity *slots = NULL;
+    uint32_t *hops = NULL;
+    if (hopscotchAlloc(cap, &slots, &hops) != 0) {
+        return ht_ErrCannotInsert;
+    }
+    Entities stash = ht->stash;
+    Entity *old = ht->slots;
+    uint32_t *old_hops = ht->hops;
+    size_t old_cap = ht->cap;
+
+    memset(&ht->stash, 0, sizeof(Entities));
+    for (size_t i = 0; i < old_cap + stash.len; i++) {
+        Entity *en = i < old_cap ? &old[i] : &stash.arr[i - old_cap];
+        if (!en->key) {
+            continue;
+        }
+        if (!place(slots, hops, cap, *en) && !pushEntity(&ht->stash, *en)) {
+            free(ht->stash.arr);
+            free(slots);
+            free(hops);
+            ht->stash = stash;
+            return ht_ErrCannotInsert;
+        }
+    }
+    free(old);
+    free(old_hops);
+    free(stash.arr);
+    ht->slots = slots;
+    ht->hops = hops;
+    ht->cap = cap;
+    setThresholds(ht);
+    return 0;
+}
+
+static Entity *hopscotchFind(HT *ht, const unsigned char *key, size_t len, unsigned long h) {
+    size_t mask = ht->cap - 1;
+    size_t home = bucketIndex(h, ht->cap);
+    uint32_t bits = ht->hops[home];
+    while (bits) {
+        Entity *en = &ht->slots[(home + lowestBit(bits)) & mask];
+        if (sameKey(en, key, len, h)) {
+            return en;
+        }
+        bits &= bits - 1;
+    }
+    for (size_t i = 0; i < ht->stash.len; i++) {
+        if (sameKey(&ht->stash.arr[i], key, len, h)) {
+            return &ht->stash.arr[i];
+        }
+    }
+    return NULL;
+}
+
+// hopscotchClaim grows the table until the key finds a slot or a place in the stash,
+// every growth moves the stashed entities back to the slots.
+static Entity *hopscotchClaim(HT *ht, const unsigned char *key, size_t len, unsigned long h) {
+    Entity carry = {
+        .key = (unsigned char*)key,
+        .value = NULL,
+        .hash = h,
+        .key_len = len,
+    };
+    for (;;) {
+        Entity *en = place(ht->slots, ht->hops, ht->cap, carry);
+        if (en) {
+            return en;
+        }
+        if (ht->stash.len < HopStashMax || inseparable(ht, h)) {
+            return pushEntity(&ht->stash, carry);
+        }
+        if (hopscotchResize(ht, ht->cap*2) != 0) {
+            return NULL;
+        }
+    }
+}
+
+static Entity *hopscotchInsert(HT *ht, const unsigned char *key, size_t len, unsigned long h, int *inserted) {
+    Entity *en = hopscotchFind(ht, key, len, h);
+    *inserted = 0;
+    if (en) {
+        return en;
+    }
+    en = hopscotchClaim(ht, key, len, h);
+    *inserted = en != NULL;
+    return en;
+}
+
+static int hopscotchRemove(HT *ht, const unsigned char *key, size_t len, unsigned long h, void **value) {
+    Entity *en = hopscotchFind(ht, key, len, h);
+    if (!en) {
+        return 0;
+    }
+    *value = en->value;
+    if (en >= ht->slots && en < ht->slots + ht->cap) {
+        size_t slot = (size_t)(en - ht->slots);
+        size_t home = bucketIndex(h, ht->cap);
+        ht->hops[home] &= ~hopBit((slot - home) & (ht->cap - 1));
+        memset(en, 0, sizeof(Entity));
+    } else {
+        *en = ht->stash.arr[--ht->stash.len];
+    }
+    return 1;
+}
+
+static size_t hopscotchRetain(HT *ht, ht_RetainFunction pred, void *ctx) {
+    size_t removed = 0;
+    for (size_t i = 0; i < ht->cap; i++) {
+        Entity *en = &ht->slots[i];
+        if (en->key && !pred(en, ctx)) {
+            size_t home = bucketIndex(en->hash, ht->cap);
+            ht->hops[home] &= ~hopBit((i - home) & (ht->cap - 1));
+            memset(en, 0, sizeof(Entity));
+            removed++;
+        }
+    }
+    return removed + retainEntities(&ht->stash, pred, ctx);
+}
+
+static Entity *hopscotchNext(HT *ht, Iterator *it) {
+    size_t end = iterEnd(ht, it);
+    for (size_t i = it->hash_table_idx; i < end; i++) {
+        if (ht->slots[i].key) {
+            it->hash_table_idx = i + 1;
+            return &ht->slots[i];
+        }
+    }
+    if (it->end_idx <= ht->cap) {
+        it->hash_table_idx = end;
+        return NULL;
+    }
+    size_t s = it->hash_table_idx > ht->cap ? it->hash_table_idx - ht->cap : 0;
+    if (s < ht->stash.len) {
+        it->hash_table_idx = ht->cap + s + 1;
+        return &ht->stash.arr[s];
+    }
+    it->hash_table_idx = ht->cap + ht->stash.len;
+    return NULL;
+}
+
+// hopscotchNextBatch reads the slots in one pass, prefetching the lines ahead of the scan, then the stash.
+static size_t hopscotchNextBatch(HT *ht, Iterator *it, Entity *out[], size_t max) {
+    size_t end = iterEnd(ht, it);
+    size_t i = it->hash_table_idx;
+    size_t n = 0;
+    for (; i < end && n < max; i++) {
+        prefetchScan(ht->slots, i, end);
+        if (ht->slots[i].key) {
+            out[n++] = &ht->slots[i];
+        }
+    }
+    it->hash_table_idx = i;
+    if (i < end) {
+        return n;
+    }
+    return stashNextBatch(ht, it, out, n, max);
+}
+
+// hopscotchPrefetch loads the bitmap and home slot, then the entities the bitmap points at, then their keys.
+static void hopscotchPrefetch(const HT *ht, unsigned long h, unsigned stage) {
+    size_t mask = ht->cap - 1;
+    size_t home = bucketIndex(h, ht->cap);
+    if (stage == 0) {
+        prefetchRead(&ht->hops[home]);
+        prefetchRead(&ht->slots[home]);
+        return;
+    }
+    for (uint32_t bits = ht->hops[home]; bits; bits &= bits - 1) {
+        const Entity *en = &ht->slots[(home + lowestBit(bits)) & mask];
+        if (stage == 1) {
+            prefetchRead(en);
+        } else if (en->hash == h) {
+            prefetchRead(en->key);
+            return;
+        }
+    }
+}
+
+const EngineOps ht_hopscotchEngine = {
+    .default_max_load = HopscotchMaxLoadFactor,
+    .max_load_limit = HopscotchMaxLoadLimit,
+    .init = hopscotchInit,
+    .release = hopscotchRelease,
+    .resize = hopscotchResize,
+    .find = hopscotchFind,
+    .insert = hopscotchInsert,
+    .claim = hopscotchClaim,
+    .remove = hopscotchRemove,
+    .retain = hopscotchRetain,
+    .next = hopscotchNext,
+    .nextBatch = hopscotchNextBatch,
+    .prefetch = hopscotchPrefetch,
+};
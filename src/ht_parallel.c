@@ -0,0 +1,171 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "ht.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+// ht_Pool keeps its threads waiting on a condition variable between scans, so a scan only wakes them.
+// Each scan bumps the generation, every thread runs once per generation and the caller waits for
+// all of them before returning, so the next scan never meets a thread still busy with the last one.
+// The workers share a counter of the next range to scan, ranges are scanned once however many threads run.
+
+#define RangesPerWorker 8
+#define ScanBatch 64
+
+typedef struct {
+    HT *ht;
+    ht_VisitFunction fn;
+    void *ctx;
+    size_t nparts;
+    size_t next_part;
+} Scan;
+
+typedef struct {
+    ht_Pool *pool;
+    size_t worker;
+} Worker;
+
+struct ht_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    pthread_t *threads;
+    Worker *workers;
+    size_t started;
+    size_t running;
+    unsigned long generation;
+    int stop;
+    Scan scan;
+};
+
+static size_t takePart(ht_Pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    size_t part = pool->scan.next_part;
+    if (part < pool->scan.nparts) {
+        pool->scan.next_part++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return part;
+}
+
+static void scanRanges(ht_Pool *pool, size_t worker) {
+    Scan *scan = &pool->scan;
+    for (size_t part = takePart(pool); part < scan->nparts; part = takePart(pool)) {
+        Iterator it = ht_iterator_range(scan->ht, part, scan->nparts);
+        Entity *batch[ScanBatch];
+        for (size_t n = ht_next_batch(scan->ht, &it, batch, ScanBatch); n; n = ht_next_batch(scan->ht, &it, batch, ScanBatch)) {
+            for (size_t i = 0; i < n; i++) {
+                scan->fn(batch[i], worker, scan->ctx);
+            }
+        }
+    }
+}
+
+static void *workerLoop(void *arg) {
+    Worker *w = arg;
+    ht_Pool *pool = w->pool;
+    unsigned long seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->stop && pool->generation == seen) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->stop) {
+            break;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+        scanRanges(pool, w->worker);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->running == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static ht_Pool *freePool(ht_Pool *pool) {
+    free(pool->threads);
+    free(pool->workers);
+    free(pool);
+    return NULL;
+}
+
+ht_Pool *ht_pool_new(size_t workers) {
+    if (workers == 0) {
+        workers = 1;
+    }
+    ht_Pool *pool = calloc(1, sizeof(ht_Pool));
+    if (!pool) {
+        return NULL;
+    }
+    pool->threads = malloc(workers*sizeof(pthread_t));
+    pool->workers = malloc(workers*sizeof(Worker));
+    if (!pool->threads || !pool->workers || pthread_mutex_init(&pool->lock, NULL) != 0) {
+        return freePool(pool);
+    }
+    if (pthread_cond_init(&pool->start, NULL) != 0) {
+        pthread_mutex_destroy(&pool->lock);
+        return freePool(pool);
+    }
+    if (pthread_cond_init(&pool->done, NULL) != 0) {
+        pthread_cond_destroy(&pool->start);
+        pthread_mutex_destroy(&pool->lock);
+        return freePool(pool);
+    }
+    for (size_t i = 1; i < workers; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].worker = i;
+        if (pthread_create(&pool->threads[i], NULL, workerLoop, &pool->workers[i]) != 0) {
+            break;
+        }
+        pool->started++;
+    }
+    return pool;
+}
+
+void ht_pool_free(ht_Pool *pool) {
+    if (!pool) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t i = 1; i <= pool->started; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    pthread_mutex_destroy(&pool->lock);
+    freePool(pool);
+}
+
+int ht_for_each_parallel(HT *ht, ht_Pool *pool, ht_VisitFunction fn, void *ctx) {
+    if (!ht || !pool || !fn) {
+        return ht_ErrDoNotExists;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->scan = (Scan){
+        .ht = ht,
+        .fn = fn,
+        .ctx = ctx,
+        .nparts = (pool->started + 1)*RangesPerWorker,
+        .next_part = 0,
+    };
+    pool->running = pool->started;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    scanRanges(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
@@ -0,0 +1,219 @@
+#include "ht.h"
+#include "ht_engine.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Robin Hood hashing keeps entities in a flat slot array with linear probing.
+// An insertion takes the slot of any entity closer to its home slot than the inserted one,
+// which keeps probe lengths short and even at high loads.
+// The probe distance is derived from the cached hash and an empty slot has a NULL key,
+// so the engine needs no memory besides the slots.
+// Deletion shifts the following entities one slot back, leaving no tombstones.
+
+#define RobinHoodMaxLoadFactor 0.9
+#define RobinHoodMaxLoadLimit 0.95
+
+static inline size_t probeDistance(const HT *ht, size_t slot) {
+    return (slot - bucketIndex(ht->slots[slot].hash, ht->cap)) & (ht->cap - 1);
+}
+
+// place stores the entity in slots of cap, displacing richer entities further.
+// Returns the slot the entity landed in.
+static size_t place(Entity *slots, size_t cap, Entity carry) {
+    size_t mask = cap - 1;
+    size_t slot = bucketIndex(carry.hash, cap);
+    size_t dist = 0;
+    size_t landed = cap;
+    while (slots[slot].key) {
+        size_t existing = (slot - bucketIndex(slots[slot].hash, cap)) & mask;
+        if (existing < dist) {
+            Entity tmp = slots[slot];
+            slots[slot] = carry;
+            carry = tmp;
+            if (landed == cap) {
+                landed = slot;
+            }
+            dist = existing;
+        }
+        slot = (slot + 1) & mask;
+        dist++;
+    }
+    slots[slot] = carry;
+    return landed == cap ? slot : landed;
+}
+
+static int robinHoodInit(HT *ht, size_t cap) {
+    ht->slots = calloc(cap, sizeof(Entity));
+    return ht->slots ? 0 : ht_ErrCannotInsert;
+}
+
+static void robinHoodRelease(HT *ht) {
+    free(ht->slots);
+    ht->slots = NULL;
+}
+
+static int robinHoodResize(HT *ht, size_t cap) {
+    if (cap <= ht->len) {
+        return ht_ErrCannotInsert;
+    }
+    Entity *slots = calloc(cap, sizeof(Entity));
+    if (!slots) {
+        return ht_ErrCannotInsert;
+    }
+    for (size_t i = 0; i < ht->cap; i++) {
+        if (ht->slots[i].key) {
+            place(slots, cap, ht->slots[i]);
+        }
+    }
+    free(ht->slots);
+    ht->slots = slots;
+    ht->cap = cap;
+    setThresholds(ht);
+    return 0;
+}
+
+static Entity *robinHoodFind(HT *ht, const unsigned char *key, size_t len, unsigned long h) {
+    size_t mask = ht->cap - 1;
+    size_t slot = bucketIndex(h, ht->cap);
+    for (size_t dist = 0; ht->slots[slot].key; dist++) {
+        // Every entity at this point or later is closer to its home than the key would be.
+        if (probeDistance(ht, slot) < dist) {
+            return NULL;
+        }
+        if (sameKey(&ht->slots[slot], key, len, h)) {
+            return &ht->slots[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+static Entity *robinHoodClaim(HT *ht, const unsigned char *key, size_t len, unsigned long h) {
+    if (ht->len + 1 >= ht->cap) {
+        return NULL;
+    }
+    Entity carry = {
+        .key = (unsigned char*)key,
+        .value = NULL,
+        .hash = h,
+        .key_len = len,
+    };
+    return &ht->slots[place(ht->slots, ht->cap, carry)];
+}
+
+static Entity *robinHoodInsert(HT *ht, const unsigned char *key, size_t len, unsigned long h, int *inserted) {
+    Entity *en = robinHoodFind(ht, key, len, h);
+    *inserted = 0;
+    if (en) {
+        return en;
+    }
+    en = robinHoodClaim(ht, key, len, h);
+    *inserted = en != NULL;
+    return en;
+}
+
+// shiftBack removes the entity of the slot, moving the following entities one slot back.
+static void shiftBack(HT *ht, size_t slot) {
+    size_t mask = ht->cap - 1;
+    size_t next = (slot + 1) & mask;
+    while (ht->slots[next].key && probeDistance(ht, next) > 0) {
+        ht->slots[slot] = ht->slots[next];
+        slot = next;
+        next = (next + 1) & mask;
+    }
+    memset(&ht->slots[slot], 0, sizeof(Entity));
+}
+
+static int robinHoodRemove(HT *ht, const unsigned char *key, size_t len, unsigned long h, void **value) {
+    Entity *en = robinHoodFind(ht, key, len, h);
+    if (!en) {
+        return 0;
+    }
+    *value = en->value;
+    shiftBack(ht, (size_t)(en - ht->slots));
+    return 1;
+}
+
+// robinHoodRetain scans from an empty slot, which no shift crosses, so every entity is visited once.
+// A removal shifts the next entity into the slot, the slot is checked again before moving on.
+static size_t robinHoodRetain(HT *ht, ht_RetainFunction pred, void *ctx) {
+    size_t mask = ht->cap - 1;
+    size_t start = 0;
+    while (ht->slots[start].key) {
+        start++;
+    }
+    size_t removed = 0;
+    for (size_t step = 1; step <= ht->cap;) {
+        size_t slot = (start + step) & mask;
+        if (ht->slots[slot].key && !pred(&ht->slots[slot], ctx)) {
+            shiftBack(ht, slot);
+            removed++;
+            continue;
+        }
+        step++;
+    }
+    return removed;
+}
+
+static Entity *robinHoodNext(HT *ht, Iterator *it) {
+    size_t end = iterEnd(ht, it);
+    for (size_t i = it->hash_table_idx; i < end; i++) {
+        if (ht->slots[i].key) {
+            it->hash_table_idx = i + 1;
+            return &ht->slots[i];
+        }
+    }
+    it->hash_table_idx = end;
+    return NULL;
+}
+
+// robinHoodNextBatch reads the slots in one pass, prefetching the lines ahead of the scan.
+static size_t robinHoodNextBatch(HT *ht, Iterator *it, Entity *out[], size_t max) {
+    size_t end = iterEnd(ht, it);
+    size_t i = it->hash_table_idx;
+    size_t n = 0;
+    for (; i < end && n < max; i++) {
+        prefetchScan(ht->slots, i, end);
+        if (ht->slots[i].key) {
+            out[n++] = &ht->slots[i];
+        }
+    }
+    it->hash_table_idx = i;
+    return n;
+}
+
+// robinHoodPrefetch loads the home slot, then the key of the first entity of the probe with the hash.
+static void robinHoodPrefetch(const HT *ht, unsigned long h, unsigned stage) {
+    size_t mask = ht->cap - 1;
+    size_t slot = bucketIndex(h, ht->cap);
+    if (stage == 0) {
+        prefetchRead(&ht->slots[slot]);
+        return;
+    }
+    if (stage == 2) {
+        return;
+    }
+    for (size_t dist = 0; ht->slots[slot].key && probeDistance(ht, slot) >= dist; dist++) {
+        if (ht->slots[slot].hash == h) {
+            prefetchRead(ht->slots[slot].key);
+            return;
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+const EngineOps ht_robinHoodEngine = {
+    .default_max_load = RobinHoodMaxLoadFactor,
+    .max_load_limit = RobinHoodMaxLoadLimit,
+    .init = robinHoodInit,
+    .release = robinHoodRelease,
+    .resize = robinHoodResize,
+    .find = robinHoodFind,
+    .insert = robinHoodInsert,
+    .claim = robinHoodClaim,
+    .remove = robinHoodRemove,
+    .retain = robinHoodRetain,
+    .next = robinHoodNext,
+    .nextBatch = robinHoodNextBatch,
+    .prefetch = robinHoodPrefetch,
+};
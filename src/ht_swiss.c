@@ -0,0 +1,319 @@
+#include "ht.h"
+#include "ht_engine.h"
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Swiss table keeps entities in a flat slot array and a control byte per slot.
+// A full slot's control byte holds 7 bits of the hash, so a lookup compares 16 control bytes at once
+// and only touches the slots whose fingerprint matches.
+// Groups of 16 slots are aligned and probed triangularly, which visits every group of a power of two table.
+
+#define GroupWidth 16
+#define GroupBits 4
+#define CtrlEmpty ((unsigned char)0x80)
+#define CtrlDeleted ((unsigned char)0xFE)
+#define SwissMaxLoadFactor 0.875
+#define SwissMaxLoadLimit 0.9375
+
+// GroupMask has bit i set when slot i of the group matches.
+typedef unsigned int GroupMask;
+
+static inline GroupMask matchByte(const unsigned char *group, unsigned char b) {
+#if defined(__SSE2__)
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return (GroupMask)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)b)));
+#else
+    GroupMask mask = 0;
+    for (unsigned i = 0; i < GroupWidth; i++) {
+        if (group[i] == b) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+// matchFree matches empty and deleted slots, both have the high bit set.
+static inline GroupMask matchFree(const unsigned char *group) {
+#if defined(__SSE2__)
+    return (GroupMask)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+    GroupMask mask = 0;
+    for (unsigned i = 0; i < GroupWidth; i++) {
+        if (group[i] & 0x80) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+// Probe is the position in the group probe sequence of a hash.
+typedef struct {
+    size_t group;
+    size_t mask;
+    size_t step;
+    unsigned char h2;
+} Probe;
+
+static inline Probe probeStart(size_t cap, unsigned long h) {
+    uint64_t m = mixHash(h);
+    unsigned bits = capBits(cap) - GroupBits;
+    Probe p = {
+        .group = bits ? (size_t)(m >> (64 - bits)) : 0,
+        .mask = (cap >> GroupBits) - 1,
+        .step = 0,
+        .h2 = (unsigned char)((m >> (57 - bits)) & 0x7F),
+    };
+    return p;
+}
+
+static inline void probeNext(Probe *p) {
+    p->step++;
+    p->group = (p->group + p->step) & p->mask;
+}
+
+// freeSlot returns the first empty or deleted slot on the probe sequence, or cap if the table is full.
+static size_t freeSlot(const unsigned char *ctrl, size_t cap, unsigned long h) {
+    Probe p = probeStart(cap, h);
+    for (size_t i = 0; i <= p.mask; i++) {
+        GroupMask free_slots = matchFree(&ctrl[p.group*GroupWidth]);
+        if (free_slots) {
+            return p.group*GroupWidth + lowestBit(free_slots);
+        }
+        probeNext(&p);
+    }
+    return cap;
+}
+
+static int swissAlloc(size_t cap, Entity **slots, unsigned char **ctrl) {
+    *slots = malloc(cap*sizeof(Entity));
+    *ctrl = malloc(cap);
+    if (!*slots || !*ctrl) {
+        free(*slots);
+        free(*ctrl);
+        return ht_ErrCannotInsert;
+    }
+    memset(*ctrl, CtrlEmpty, cap);
+    return 0;
+}
+
+static int swissInit(HT *ht, size_t cap) {
+    if (cap < GroupWidth) {
+        cap = GroupWidth;
+    }
+    ht->cap = cap;
+    ht->tombstones = 0;
+    return swissAlloc(cap, &ht->slots, &ht->ctrl);
+}
+
+static void swissRelease(HT *ht) {
+    free(ht->slots);
+    free(ht->ctrl);
+    ht->slots = NULL;
+    ht->ctrl = NULL;
+    ht->tombstones = 0;
+}
+
+// swissResize reinserts every full slot into fresh arrays, dropping the tombstones.
+// The cached hashes place entities without comparing any keys.
+static int swissResize(HT *ht, size_t cap) {
+    if (cap < GroupWidth || cap < ht->len) {
+        return ht_ErrCannotInsert;
+    }
+    Entity *slots = NULL;
+    unsigned char *ctrl = NULL;
+    if (swissAlloc(cap, &slots, &ctrl) != 0) {
+        return ht_ErrCannotInsert;
+    }
+    for (size_t i = 0; i < ht->cap; i++) {
+        if (ht->ctrl[i] & 0x80) {
+            continue;
+        }
+        Entity *en = &ht->slots[i];
+        size_t slot = freeSlot(ctrl, cap, en->hash);
+        ctrl[slot] = probeStart(cap, en->hash).h2;
+        slots[slot] = *en;
+    }
+    free(ht->slots);
+    free(ht->ctrl);
+    ht->slots = slots;
+    ht->ctrl = ctrl;
+    ht->cap = cap;
+    ht->tombstones = 0;
+    setThresholds(ht);
+    return 0;
+}
+
+static Entity *swissFind(HT *ht, const unsigned char *key, size_t len, unsigned long h) {
+    Probe p = probeStart(ht->cap, h);
+    for (size_t i = 0; i <= p.mask; i++) {
+        const unsigned char *group = &ht->ctrl[p.group*GroupWidth];
+        GroupMask match = matchByte(group, p.h2);
+        while (match) {
+            Entity *en = &ht->slots[p.group*GroupWidth + lowestBit(match)];
+            if (sameKey(en, key, len, h)) {
+                return en;
+            }
+            match &= match - 1;
+        }
+        if (matchByte(group, CtrlEmpty)) {
+            return NULL;
+        }
+        probeNext(&p);
+    }
+    return NULL;
+}
+
+static Entity *swissClaim(HT *ht, const unsigned char *key, size_t len, unsigned long h) {
+    if (ht->len + ht->tombstones >= ht->grow_at) {
+        // Tombstones alone pushed the table over its load, rehashing at the same capacity clears them.
+        size_t cap = ht->len >= ht->grow_at ? ht->cap*2 : ht->cap;
+        swissResize(ht, cap);
+    }
+    size_t slot = freeSlot(ht->ctrl, ht->cap, h);
+    if (slot == ht->cap) {
+        return NULL;
+    }
+    if (ht->ctrl[slot] == CtrlDeleted) {
+        ht->tombstones--;
+    }
+    ht->ctrl[slot] = probeStart(ht->cap, h).h2;
+    Entity *en = &ht->slots[slot];
+    en->key = (unsigned char*)key;
+    en->value = NULL;
+    en->hash = h;
+    en->key_len = len;
+    return en;
+}
+
+static Entity *swissInsert(HT *ht, const unsigned char *key, size_t len, unsigned long h, int *inserted) {
+    Entity *en = swissFind(ht, key, len, h);
+    *inserted = 0;
+    if (en) {
+        return en;
+    }
+    en = swissClaim(ht, key, len, h);
+    *inserted = en != NULL;
+    return en;
+}
+
+static void clearSlot(HT *ht, size_t slot) {
+    // A group that still has an empty slot never let a probe pass through it,
+    // so the slot can become empty again instead of a tombstone.
+    if (matchByte(&ht->ctrl[slot - slot%GroupWidth], CtrlEmpty)) {
+        ht->ctrl[slot] = CtrlEmpty;
+    } else {
+        ht->ctrl[slot] = CtrlDeleted;
+        ht->tombstones++;
+    }
+}
+
+static int swissRemove(HT *ht, const unsigned char *key, size_t len, unsigned long h, void **value) {
+    Entity *en = swissFind(ht, key, len, h);
+    if (!en) {
+        return 0;
+    }
+    *value = en->value;
+    clearSlot(ht, (size_t)(en - ht->slots));
+    return 1;
+}
+
+static size_t swissRetain(HT *ht, ht_RetainFunction pred, void *ctx) {
+    size_t removed = 0;
+    for (size_t base = 0; base < ht->cap; base += GroupWidth) {
+        for (GroupMask full = ~matchFree(&ht->ctrl[base]) & 0xFFFFu; full; full &= full - 1) {
+            size_t slot = base + lowestBit(full);
+            if (!pred(&ht->slots[slot], ctx)) {
+                clearSlot(ht, slot);
+                removed++;
+            }
+        }
+    }
+    return removed;
+}
+
+static Entity *swissNext(HT *ht, Iterator *it) {
+    size_t end = iterEnd(ht, it);
+    size_t i = it->hash_table_idx;
+    while (i < end) {
+        size_t base = i - i%GroupWidth;
+        GroupMask full = ~matchFree(&ht->ctrl[base]) & 0xFFFFu;
+        full &= ~0u << (i - base);
+        if (full && base + lowestBit(full) < end) {
+            size_t slot = base + lowestBit(full);
+            it->hash_table_idx = slot + 1;
+            return &ht->slots[slot];
+        }
+        i = base + GroupWidth;
+    }
+    it->hash_table_idx = end;
+    return NULL;
+}
+
+// swissNextBatch reads the full slot mask of each group once and emits all its slots,
+// prefetching the full slots of the group ScanAhead slots ahead.
+static size_t swissNextBatch(HT *ht, Iterator *it, Entity *out[], size_t max) {
+    size_t end = iterEnd(ht, it);
+    size_t i = it->hash_table_idx;
+    size_t n = 0;
+    while (i < end && n < max) {
+        size_t base = i - i%GroupWidth;
+        if (i == base && base + ScanAhead < end) {
+            GroupMask ahead = ~matchFree(&ht->ctrl[base + ScanAhead]) & 0xFFFFu;
+            for (; ahead; ahead &= ahead - 1) {
+                prefetchRead(&ht->slots[base + ScanAhead + lowestBit(ahead)]);
+            }
+        }
+        GroupMask full = ~matchFree(&ht->ctrl[base]) & 0xFFFFu;
+        full &= ~0u << (i - base);
+        if (end - base < GroupWidth) {
+            full &= (1u << (end - base)) - 1;
+        }
+        for (; full && n < max; full &= full - 1) {
+            out[n++] = &ht->slots[base + lowestBit(full)];
+        }
+        i = full ? base + lowestBit(full) : base + GroupWidth;
+    }
+    it->hash_table_idx = i < end ? i : end;
+    return n;
+}
+
+// swissPrefetch follows the first group of the probe: control bytes, the first slot matching h2, its key.
+static void swissPrefetch(const HT *ht, unsigned long h, unsigned stage) {
+    Probe p = probeStart(ht->cap, h);
+    const unsigned char *group = &ht->ctrl[p.group*GroupWidth];
+    if (stage == 0) {
+        prefetchRead(group);
+        return;
+    }
+    GroupMask match = matchByte(group, p.h2);
+    if (!match) {
+        return;
+    }
+    const Entity *en = &ht->slots[p.group*GroupWidth + lowestBit(match)];
+    if (stage == 1) {
+        prefetchRead(en);
+    } else if (en->hash == h) {
+        prefetchRead(en->key);
+    }
+}
+
+const EngineOps ht_swissEngine = {
+    .default_max_load = SwissMaxLoadFactor,
+    .max_load_limit = SwissMaxLoadLimit,
+    .init = swissInit,
+    .release = swissRelease,
+    .resize = swissResize,
+    .find = swissFind,
+    .insert = swissInsert,
+    .claim = swissClaim,
+    .remove = swissRemove,
+    .retain = swissRetain,
+    .next = swissNext,
+    .nextBatch = swissNextBatch,
+    .prefetch = swissPrefetch,
+};
@@ -1,20 +1,30 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/time.h>
 #include "../test-framework/unity.h"
 #include "ht.h"
 
 #define ARR_SIZE 1000*1000
 
+// all_engines lists every engine, for the tests that run against each of them.
+static const ht_Engine all_engines[] = {ht_EngineChained, ht_EngineSwiss, ht_EngineRobinHood, ht_EngineCuckoo, ht_EngineHopscotch};
+#define EngineCount (sizeof(all_engines)/sizeof(all_engines[0]))
+
+// test_engine is the engine the insert, read, delete and iterator tests run against.
+static ht_Engine test_engine = ht_EngineChained;
+
 typedef struct {
     char **arr;
     size_t len;
 } StrArr_view;
 
-void str_arr_free(StrArr_view sa_v) {
-    for (int i = 0; i < ARR_SIZE; i++) {
+static void str_arr_free(StrArr_view sa_v) {
+    for (size_t i = 0; i < sa_v.len; i++) {
         if (sa_v.arr[i])
             free(sa_v.arr[i]);
     }
@@ -23,7 +33,7 @@ void str_arr_free(StrArr_view sa_v) {
         free(sa_v.arr);
 }
 
-StrArr_view read(char *file) {
+static StrArr_view read(char *file) {
     FILE * fp;
     char * line = NULL;
     size_t len = 0;
@@ -57,6 +67,32 @@ StrArr_view read(char *file) {
     return arr_view;
 }
 
+static StrArr_view generate(size_t n) {
+    StrArr_view arr_view = {
+        .arr = malloc(sizeof(char *)*n),
+        .len = n
+    };
+    for (size_t i = 0; i < n; i++) {
+        char *str = malloc(sizeof(char)*32);
+        snprintf(str, 32, "key-%zu", i);
+        arr_view.arr[i] = str;
+    }
+    return arr_view;
+}
+
+static void shuffle(StrArr_view sa_v) {
+    uint64_t state = 0x2545F4914F6CDD1Dull;
+    for (size_t i = sa_v.len; i > 1; i--) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        size_t j = (size_t)(state%i);
+        char *tmp = sa_v.arr[i-1];
+        sa_v.arr[i-1] = sa_v.arr[j];
+        sa_v.arr[j] = tmp;
+    }
+}
+
 typedef struct {
     unsigned long hash;
     int counter;
@@ -68,12 +104,12 @@ typedef struct {
     size_t len;
 } OccuranceArr_view;
 
-void occurance_arr_free(OccuranceArr_view oa_v) {
+static void occurance_arr_free(OccuranceArr_view oa_v) {
     if (oa_v.arr)
         free(oa_v.arr);
 }
 
-OccuranceArr_view occurance_arr_new(size_t len) {
+static OccuranceArr_view occurance_arr_new(size_t len) {
     Occurance *arr = calloc(len, sizeof(Occurance));
     OccuranceArr_view oa_v = {
         .arr = arr,
@@ -82,7 +118,7 @@ OccuranceArr_view occurance_arr_new(size_t len) {
     return oa_v;
 }
 
-void occurance_arr_append_hash(OccuranceArr_view oa_v, unsigned long hash) {
+static void occurance_arr_append_hash(OccuranceArr_view oa_v, unsigned long hash) {
     size_t pos =  (size_t)((hash)%(unsigned long)oa_v.len);
     Occurance exs = oa_v.arr[pos];
     if (hash != exs.hash) {
@@ -92,7 +128,7 @@ void occurance_arr_append_hash(OccuranceArr_view oa_v, unsigned long hash) {
     oa_v.arr[pos] = exs;
 }
 
-size_t occurance_arr_count_distinct(OccuranceArr_view oa_v) {
+static size_t occurance_arr_count_distinct(OccuranceArr_view oa_v) {
     size_t counter = 0;
     for (size_t i = 0; i < oa_v.len; i++) {
         if (oa_v.arr[i].counter == 1 && oa_v.arr[i].hash != 0){
@@ -181,6 +217,50 @@ static void testHashCollisionsLL(void)
     TEST_ASSERT_NOT_EQUAL(all, distinct);
 }
 
+static void testHashCollisionsWYSuccess(void)
+{
+    StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
+
+    size_t multiplier = 10*1000; 
+
+    OccuranceArr_view oa_v = occurance_arr_new(sa_v.len*multiplier);
+
+    for (size_t i = 0; i < sa_v.len; i++) {
+        unsigned long hs = ht_HashWY((unsigned char*)sa_v.arr[i]);
+        occurance_arr_append_hash(oa_v, hs);
+    }
+
+    size_t distinct = occurance_arr_count_distinct(oa_v);
+    size_t all = sa_v.len;
+
+    str_arr_free(sa_v);
+    occurance_arr_free(oa_v);
+
+    TEST_ASSERT_EQUAL(all, distinct);
+}
+
+static void testHashCollisionsHWSuccess(void)
+{
+    StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
+
+    size_t multiplier = 10*1000; 
+
+    OccuranceArr_view oa_v = occurance_arr_new(sa_v.len*multiplier);
+
+    for (size_t i = 0; i < sa_v.len; i++) {
+        unsigned long hs = ht_HashHW((unsigned char*)sa_v.arr[i]);
+        occurance_arr_append_hash(oa_v, hs);
+    }
+
+    size_t distinct = occurance_arr_count_distinct(oa_v);
+    size_t all = sa_v.len;
+
+    str_arr_free(sa_v);
+    occurance_arr_free(oa_v);
+
+    TEST_ASSERT_EQUAL(all, distinct);
+}
+
 static void bechHashCollisionsDjb2(void)
 {
     const size_t repetitons = 10000;
@@ -256,13 +336,65 @@ static void benchHashCollisionsLL (void)
     TEST_ASSERT_EQUAL(0, 0);
 }
 
+static void benchHashCollisionsWY(void)
+{
+    const size_t repetitons = 10000;
+    StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
+    
+    struct timeval begin, end;
+    gettimeofday(&begin, 0);
+    
+    size_t counter = 0;
+    for (size_t rep = 0; rep < repetitons; rep++) {
+        for (size_t i = 0; i < sa_v.len; i++) {
+            ht_HashWY((unsigned char*)sa_v.arr[i]);
+            counter++;
+        }
+    }
+
+    gettimeofday(&end, 0);
+    long seconds = end.tv_sec - begin.tv_sec;
+    long microseconds = end.tv_usec - begin.tv_usec;
+    double elapsed = seconds + microseconds*1e-6;
+    printf("ht_HashWY calculating %zu hashes took [ %f_sec ]\n", counter, elapsed);
+
+    str_arr_free(sa_v);
+    TEST_ASSERT_EQUAL(0, 0);
+}
+
+static void benchHashCollisionsHW(void)
+{
+    const size_t repetitons = 10000;
+    StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
+    
+    struct timeval begin, end;
+    gettimeofday(&begin, 0);
+    
+    size_t counter = 0;
+    for (size_t rep = 0; rep < repetitons; rep++) {
+        for (size_t i = 0; i < sa_v.len; i++) {
+            ht_HashHW((unsigned char*)sa_v.arr[i]);
+            counter++;
+        }
+    }
+
+    gettimeofday(&end, 0);
+    long seconds = end.tv_sec - begin.tv_sec;
+    long microseconds = end.tv_usec - begin.tv_usec;
+    double elapsed = seconds + microseconds*1e-6;
+    printf("ht_HashHW calculating %zu hashes took [ %f_sec ]\n", counter, elapsed);
+
+    str_arr_free(sa_v);
+    TEST_ASSERT_EQUAL(0, 0);
+}
+
 static void testInsertAllHashFunc(void) {
     StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
 
     ht_HashFunction hash_functions[3] = {ht_HashDJB2, ht_HashSDBM, ht_HashLL};
 
     for (size_t n = 0; n < 3; n++) {    
-        HT ht = ht_new(100*1000, hash_functions[n]);
+        HT ht = ht_newEngine(100*1000, hash_functions[n], test_engine);
 
         size_t **arr = calloc(sa_v.len, sizeof(int*));
 
@@ -288,7 +420,7 @@ static void testReadAllHashFunc(void) {
     ht_HashFunction hash_functions[3] = {ht_HashDJB2, ht_HashSDBM, ht_HashLL};
 
     for (size_t n = 0; n < 3; n++) {    
-        HT ht = ht_new(100*1000, hash_functions[n]);
+        HT ht = ht_newEngine(100*1000, hash_functions[n], test_engine);
 
         size_t **arr = calloc(sa_v.len, sizeof(int*));
 
@@ -320,7 +452,7 @@ static void testDeleteAllHashfunc(void) {
     ht_HashFunction hash_functions[3] = {ht_HashDJB2, ht_HashSDBM, ht_HashLL};
 
     for (size_t n = 0; n < 3; n++) {    
-        HT ht = ht_new(100*1000, hash_functions[n]);
+        HT ht = ht_newEngine(100*1000, hash_functions[n], test_engine);
 
         size_t **arr = calloc(sa_v.len, sizeof(int*));
 
@@ -478,7 +610,7 @@ static void testIteratorAllhashfunc(void) {
 
     for (size_t n = 0; n < 3; n++) {
 
-        HT ht = ht_new(100*1000, hash_functions[n]);
+        HT ht = ht_newEngine(100*1000, hash_functions[n], test_engine);
 
         size_t **arr = calloc(sa_v.len, sizeof(int*));
 
@@ -557,28 +689,2118 @@ static void benchIteratorAllHashFunc(void) {
     }
 }
 
+static void testGrowBeyondMinSize(void) {
+    StrArr_view sa_v = generate(200*1000);
 
-int main(void)
-{
-    UnityBegin("ht_test.c");
+    HT ht = ht_new(0, ht_HashDJB2);
+    TEST_ASSERT_TRUE(ht.cap >= MinSize);
+    TEST_ASSERT_EQUAL(0, ht.cap & (ht.cap - 1));
 
-    RUN_TEST(testHashCollisionsDjb2Success);
-    RUN_TEST(testHashCollisionsSdbmSuccess);
-    RUN_TEST(testHashCollisionsLL);
-    
-    RUN_TEST(bechHashCollisionsDjb2);
-    RUN_TEST(benchHashCollisionsSdbm);
-    RUN_TEST(benchHashCollisionsLL );
+    for (size_t i = 0; i < sa_v.len; i++) {
+        int result = ht_insert(&ht, (unsigned char*)sa_v.arr[i], (void*)sa_v.arr[i]);
+        TEST_ASSERT_EQUAL(0, result);
+    }
+    TEST_ASSERT_EQUAL(sa_v.len, ht.len);
+    TEST_ASSERT_TRUE(ht.cap > 65535);
+    TEST_ASSERT_TRUE((double)ht.len <= ht.max_load*(double)ht.cap);
 
-    RUN_TEST(testInsertAllHashFunc);
-    RUN_TEST(testReadAllHashFunc);
-    RUN_TEST(testDeleteAllHashfunc);
-    RUN_TEST(testIteratorAllhashfunc);
-    
-    RUN_TEST(benchInsertAllHashFunc);
-    RUN_TEST(benchReadAllHashFunc);
-    RUN_TEST(benchDeleteAllHashFunc);
-    RUN_TEST(benchIteratorAllHashFunc);
+    for (size_t i = 0; i < sa_v.len; i++) {
+        char *result = (char*)ht_read(&ht, (unsigned char*)sa_v.arr[i]);
+        TEST_ASSERT_EQUAL_PTR(sa_v.arr[i], result);
+    }
+
+    ht_free(&ht);
+    str_arr_free(sa_v);
+}
+
+static void testShrinkToMinCap(void) {
+    StrArr_view sa_v = generate(100*1000);
+
+    HT ht = ht_new(0, ht_HashSDBM);
+    TEST_ASSERT_EQUAL(0, ht_setLoadFactor(&ht, 0.75, 0.25));
+
+    for (size_t i = 0; i < sa_v.len; i++) {
+        int result = ht_insert(&ht, (unsigned char*)sa_v.arr[i], (void*)sa_v.arr[i]);
+        TEST_ASSERT_EQUAL(0, result);
+    }
+    size_t grown = ht.cap;
+    TEST_ASSERT_TRUE(grown > ht.min_cap);
+
+    for (size_t i = 0; i < sa_v.len; i++) {
+        char *result = (char*)ht_delete(&ht, (unsigned char*)sa_v.arr[i]);
+        TEST_ASSERT_EQUAL_PTR(sa_v.arr[i], result);
+        if (i == 3*sa_v.len/4) {
+            TEST_ASSERT_TRUE(ht.cap < grown);
+        }
+    }
+    TEST_ASSERT_EQUAL(0, ht.len);
+    TEST_ASSERT_EQUAL(ht.min_cap, ht.cap);
+
+    ht_free(&ht);
+    str_arr_free(sa_v);
+}
+
+static void testInsertUpdateKeepsLen(void) {
+    HT ht = ht_new(0, ht_HashLL);
+    size_t a = 1, b = 2;
+
+    TEST_ASSERT_EQUAL(0, ht_insert(&ht, (unsigned char*)"key", &a));
+    TEST_ASSERT_EQUAL(0, ht_insert(&ht, (unsigned char*)"key", &b));
+    TEST_ASSERT_EQUAL(1, ht.len);
+    TEST_ASSERT_EQUAL_PTR(&b, ht_read(&ht, (unsigned char*)"key"));
+
+    TEST_ASSERT_EQUAL(ht_ErrInvalidLoadFactor, ht_setLoadFactor(&ht, 0, 0));
+    TEST_ASSERT_EQUAL(ht_ErrInvalidLoadFactor, ht_setLoadFactor(&ht, 1.0, 0.6));
+
+    ht_free(&ht);
+}
+
+static void benchInsertGrowing(void) {
+    StrArr_view sa_v = generate(1000*1000);
+
+    HT ht = ht_new(0, ht_HashDJB2);
+
+    struct timeval begin, end;
+    gettimeofday(&begin, 0);
+    for (size_t i = 0; i < sa_v.len; i++) {
+        int result = ht_insert(&ht, (unsigned char*)sa_v.arr[i], (void*)sa_v.arr[i]);
+        TEST_ASSERT_EQUAL(0, result);
+    }
+    gettimeofday(&end, 0);
+    long seconds = end.tv_sec - begin.tv_sec;
+    long microseconds = end.tv_usec - begin.tv_usec;
+    double elapsed = seconds + microseconds*1e-6;
+    printf("Inserting %lu entities growing from %d to %lu buckets took [ %f_sec ]\n", sa_v.len, MinSize, ht.cap, elapsed);
+
+    ht_free(&ht);
+    str_arr_free(sa_v);
+}
+
+static void testIncrementalRehash(void) {
+    StrArr_view sa_v = generate(200*1000);
+
+    HT ht = ht_new(0, ht_HashDJB2);
+    TEST_ASSERT_EQUAL(0, ht_setRehashStep(&ht, 1));
+
+    bool migrated = false;
+    for (size_t i = 0; i < sa_v.len; i++) {
+        int result = ht_insert(&ht, (unsigned char*)sa_v.arr[i], (void*)sa_v.arr[i]);
+        TEST_ASSERT_EQUAL(0, result);
+        if (ht.old_table) {
+            migrated = true;
+            TEST_ASSERT_EQUAL_PTR(sa_v.arr[i/2], ht_read(&ht, (unsigned char*)sa_v.arr[i/2]));
+        }
+    }
+    TEST_ASSERT_TRUE(migrated);
+    TEST_ASSERT_EQUAL(sa_v.len, ht.len);
+
+    for (size_t i = 0; i < sa_v.len; i++) {
+        char *result = (char*)ht_read(&ht, (unsigned char*)sa_v.arr[i]);
+        TEST_ASSERT_EQUAL_PTR(sa_v.arr[i], result);
+    }
+    for (size_t i = 0; i < sa_v.len; i++) {
+        char *result = (char*)ht_delete(&ht, (unsigned char*)sa_v.arr[i]);
+        TEST_ASSERT_EQUAL_PTR(sa_v.arr[i], result);
+    }
+    TEST_ASSERT_EQUAL(0, ht.len);
+
+    ht_free(&ht);
+    str_arr_free(sa_v);
+}
+
+static void testIteratorDuringMigration(void) {
+    StrArr_view sa_v = generate(100*1000);
+
+    HT ht = ht_new(0, ht_HashSDBM);
+    TEST_ASSERT_EQUAL(0, ht_setRehashStep(&ht, 1));
+
+    size_t inserted = 0;
+    for (; inserted < sa_v.len; inserted++) {
+        int result = ht_insert(&ht, (unsigned char*)sa_v.arr[inserted], (void*)sa_v.arr[inserted]);
+        TEST_ASSERT_EQUAL(0, result);
+        if (ht.old_table && inserted > 50*1000) {
+            inserted++;
+            break;
+        }
+    }
+    TEST_ASSERT_NOT_NULL(ht.old_table);
+
+    size_t counter = 0;
+    Iterator it = ht_newIterator();
+    while (true) {
+        Entity *en = ht_next(&ht, &it);
+        if (!en) {
+            break;
+        }
+        TEST_ASSERT_EQUAL_PTR(en->key, en->value);
+        TEST_ASSERT_EQUAL_PTR(en->value, ht_read(&ht, en->key));
+        counter++;
+    }
+    TEST_ASSERT_EQUAL(inserted, counter);
+
+    ht_free(&ht);
+    str_arr_free(sa_v);
+}
+
+static void benchInsertLatencyRehash(void) {
+    StrArr_view sa_v = generate(1000*1000);
+
+    size_t steps[2] = {0, 4};
+
+    for (size_t n = 0; n < 2; n++) {
+        HT ht = ht_new(0, ht_HashDJB2);
+        ht_setRehashStep(&ht, steps[n]);
+
+        double slowest = 0;
+        struct timeval begin, end, op_begin, op_end;
+        gettimeofday(&begin, 0);
+        for (size_t i = 0; i < sa_v.len; i++) {
+            gettimeofday(&op_begin, 0);
+            int result = ht_insert(&ht, (unsigned char*)sa_v.arr[i], (void*)sa_v.arr[i]);
+            gettimeofday(&op_end, 0);
+            TEST_ASSERT_EQUAL(0, result);
+            double op = (op_end.tv_sec - op_begin.tv_sec) + (op_end.tv_usec - op_begin.tv_usec)*1e-6;
+            if (op > slowest) {
+                slowest = op;
+            }
+        }
+        gettimeofday(&end, 0);
+        long seconds = end.tv_sec - begin.tv_sec;
+        long microseconds = end.tv_usec - begin.tv_usec;
+        double elapsed = seconds + microseconds*1e-6;
+        printf("Inserting %lu entities with rehash step <%zu> took [ %f_sec ], the slowest insert took [ %f_sec ]\n", sa_v.len, steps[n], elapsed, slowest);
+
+        ht_free(&ht);
+    }
+    str_arr_free(sa_v);
+}
+
+static void benchBucketIndex(void) {
+    const size_t repetitons = 10000;
+    StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
+
+    unsigned long *hashes = malloc(sizeof(unsigned long)*sa_v.len);
+    for (size_t i = 0; i < sa_v.len; i++) {
+        hashes[i] = ht_HashDJB2((unsigned char*)sa_v.arr[i]);
+    }
+
+    // volatile capacities keep the compiler from turning the division into a multiplication.
+    volatile size_t modulo_cap = 65535;
+    volatile unsigned shift = 64 - 16;
+
+    struct timeval begin, end;
+    size_t sum = 0;
+    gettimeofday(&begin, 0);
+    for (size_t rep = 0; rep < repetitons; rep++) {
+        size_t cap = modulo_cap;
+        for (size_t i = 0; i < sa_v.len; i++) {
+            sum += (size_t)(hashes[i])%cap;
+        }
+    }
+    gettimeofday(&end, 0);
+    double elapsed = (end.tv_sec - begin.tv_sec) + (end.tv_usec - begin.tv_usec)*1e-6;
+    printf("Selecting %zu buckets with <modulo> took [ %f_sec ]\n", repetitons*sa_v.len, elapsed);
+
+    gettimeofday(&begin, 0);
+    for (size_t rep = 0; rep < repetitons; rep++) {
+        unsigned sh = shift;
+        for (size_t i = 0; i < sa_v.len; i++) {
+            sum += (size_t)(((uint64_t)hashes[i]*0x9E3779B97F4A7C15ull) >> sh);
+        }
+    }
+    gettimeofday(&end, 0);
+    elapsed = (end.tv_sec - begin.tv_sec) + (end.tv_usec - begin.tv_usec)*1e-6;
+    printf("Selecting %zu buckets with <multiply shift> took [ %f_sec ]\n", repetitons*sa_v.len, elapsed);
+
+    free(hashes);
+    str_arr_free(sa_v);
+    TEST_ASSERT_NOT_EQUAL(0, sum);
+}
+
+static void benchReadLookupCost(void) {
+    StrArr_view sa_v = generate(1000*1000);
+    shuffle(sa_v);
+
+    ht_HashFunction hash_functions[2] = {ht_HashDJB2, ht_HashSDBM};
+    char names[2][10] = {"dbj2", "sbdm"};
+
+    for (size_t n = 0; n < 2; n++) {
+        HT ht = ht_new(0, hash_functions[n]);
+        for (size_t i = 0; i < sa_v.len; i++) {
+            int result = ht_insert(&ht, (unsigned char*)sa_v.arr[i], (void*)sa_v.arr[i]);
+            TEST_ASSERT_EQUAL(0, result);
+        }
+
+        struct timeval begin, end;
+        gettimeofday(&begin, 0);
+        for (size_t i = 0; i < sa_v.len; i++) {
+            if (ht_read(&ht, (unsigned char*)sa_v.arr[i]) != sa_v.arr[i]) {
+                TEST_FAIL_MESSAGE("read returned wrong value");
+            }
+        }
+        gettimeofday(&end, 0);
+        double elapsed = (end.tv_sec - begin.tv_sec) + (end.tv_usec - begin.tv_usec)*1e-6;
+        printf("Reading %lu entities from %lu buckets with hash function <%s> took [ %f_sec ], [ %f_ns ] per lookup\n",
+               sa_v.len, ht.cap, names[n], elapsed, elapsed*1e9/(double)sa_v.len);
+
+        ht_free(&ht);
+    }
+    str_arr_free(sa_v);
+}
+
+static void testEntityCachesHash(void) {
+    StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
+
+    ht_HashFunction hash_functions[3] = {ht_HashDJB2, ht_HashSDBM, ht_HashLL};
+
+    for (size_t n = 0; n < 3; n++) {
+        HT ht = ht_new(0, hash_functions[n]);
+        for (size_t i = 0; i < sa_v.len; i++) {
+            int result = ht_insert(&ht, (unsigned char*)sa_v.arr[i], (void*)sa_v.arr[i]);
+            TEST_ASSERT_EQUAL(0, result);
+        }
+
+        Iterator it = ht_newIterator();
+        while (true) {
+            Entity *en = ht_next(&ht, &it);
+            if (!en) {
+                break;
+            }
+            TEST_ASSERT_EQUAL(hash_functions[n](en->key), en->hash);
+        }
+
+        ht_free(&ht);
+    }
+    str_arr_free(sa_v);
+}
+
+static void testSwissEngineGrowAndChurn(void) {
+    StrArr_view sa_v = generate(200*1000);
+
+    HT ht = ht_newEngine(0, ht_HashSDBM, ht_EngineSwiss);
+    size_t window = 20*1000;
+    for (size_t i = 0; i < sa_v.len; i++) {
+        int result = ht_insert(&ht, (unsigned char*)sa_v.arr[i], (void*)sa_v.arr[i]);
+        TEST_ASSERT_EQUAL(0, result);
+        if (i >= window) {
+            TEST_ASSERT_EQUAL_PTR(sa_v.arr[i-window], ht_delete(&ht, (unsigned char*)sa_v.arr[i-window]));
+        }
+    }
+    TEST_ASSERT_EQUAL(window, ht.len);
+    TEST_ASSERT_TRUE(ht.len + ht.tombstones <= ht.cap);
+    for (size_t i = 0; i < sa_v.len; i++) {
+        void *expected = i >= sa_v.len - window ? (void*)sa_v.arr[i] : NULL;
+        TEST_ASSERT_EQUAL_PTR(expected, ht_read(&ht, (unsigned char*)sa_v.arr[i]));
+    }
+
+    for (size_t i = 0; i < sa_v.len; i++) {
+        int result = ht_insert(&ht, (unsigned char*)sa_v.arr[i], (void*)sa_v.arr[i]);
+        TEST_ASSERT_EQUAL(0, result);
+    }
+    TEST_ASSERT_EQUAL(sa_v.len, ht.len);
+    TEST_ASSERT_TRUE((double)ht.len <= ht.max_load*(double)ht.cap);
+
+    ht_free(&ht);
+    str_arr_free(sa_v);
+}
+
+static void benchReadEngines(void) {
+    StrArr_view sa_v = generate(1000*1000);
+    shuffle(sa_v);
+
+    ht_Engine engines[2] = {ht_EngineChained, ht_EngineSwiss};
+    char names[2][10] = {"chained", "swiss"};
+
+    for (size_t n = 0; n < 2; n++) {
+        HT ht = ht_newEngine(0, ht_HashDJB2, engines[n]);
+        for (size_t i = 0; i < sa_v.len; i++) {
+            int result = ht_insert(&ht, (unsigned char*)sa_v.arr[i], (void*)sa_v.arr[i]);
+            TEST_ASSERT_EQUAL(0, result);
+        }
+
+        struct timeval begin, end;
+        gettimeofday(&begin, 0);
+        for (size_t i = 0; i < sa_v.len; i++) {
+            if (ht_read(&ht, (unsigned char*)sa_v.arr[i]) != sa_v.arr[i]) {
+                TEST_FAIL_MESSAGE("read returned wrong value");
+            }
+        }
+        gettimeofday(&end, 0);
+        double elapsed = (end.tv_sec - begin.tv_sec) + (end.tv_usec - begin.tv_usec)*1e-6;
+        printf("Reading %lu entities with engine <%s> took [ %f_sec ], [ %f_ns ] per lookup\n",
+               sa_v.len, names[n], elapsed, elapsed*1e9/(double)sa_v.len);
+
+        ht_free(&ht);
+    }
+    str_arr_free(sa_v);
+}
+
+static void testRobinHoodHighLoad(void) {
+    StrArr_view sa_v = generate(200*1000);
+
+    HT ht = ht_newEngine(0, ht_HashDJB2, ht_EngineRobinHood);
+    TEST_ASSERT_EQUAL(0, ht_setLoadFactor(&ht, 0.95, 0));
+    TEST_ASSERT_EQUAL(ht_ErrInvalidLoadFactor, ht_setLoadFactor(&ht, 0.99, 0));
+
+    for (size_t i = 0; i < sa_v.len; i++) {
+        int result = ht_insert(&ht, (unsigned char*)sa_v.arr[i], (void*)sa_v.arr[i]);
+        TEST_ASSERT_EQUAL(0, result);
+    }
+    TEST_ASSERT_TRUE((double)ht.len <= 0.95*(double)ht.cap);
+
+    // Deleting from the middle of clusters exercises the backward shift.
+    for (size_t i = 0; i < sa_v.len; i += 3) {
+        TEST_ASSERT_EQUAL_PTR(sa_v.arr[i], ht_delete(&ht, (unsigned char*)sa_v.arr[i]));
+    }
+    for (size_t i = 0; i < sa_v.len; i++) {
+        void *expected = i%3 ? (void*)sa_v.arr[i] : NULL;
+        TEST_ASSERT_EQUAL_PTR(expected, ht_read(&ht, (unsigned char*)sa_v.arr[i]));
+    }
+
+    ht_free(&ht);
+    str_arr_free(sa_v);
+}
+
+static size_t tableBytes(HT *ht) {
+    switch (ht->engine) {
+    case ht_EngineChained: {
+        size_t bytes = ht->cap*sizeof(Entities);
+        for (size_t i = 0; i < ht->cap; i++) {
+            bytes += ht->table[i].cap*sizeof(Entity);
+        }
+        return bytes;
+    }
+    case ht_EngineSwiss:
+        return ht->cap*(sizeof(Entity) + 1);
+    case ht_EngineCuckoo:
+        return ht->cap*(sizeof(Entity) + 1) + ht->stash.cap*sizeof(Entity);
+    case ht_EngineHopscotch:
+        return ht->cap*(sizeof(Entity) + sizeof(uint32_t)) + ht->stash.cap*sizeof(Entity);
+    default:
+        return ht->cap*sizeof(Entity);
+    }
+}
+
+static void benchEnginesAtHighLoad(void) {
+    StrArr_view sa_v = generate((size_t)(0.9*(1 << 20)));
+    shuffle(sa_v);
+
+    char names[5][12] = {"chained", "swiss", "robin hood", "cuckoo", "hopscotch"};
+    double loads[5] = {1.0, 0.9375, 0.95, 0.95, 0.95};
+
+    for (size_t n = 0; n < EngineCount; n++) {
+        // The entities fill 2^20 slots to 0.9 load.
+        HT ht = ht_newEngine(1 << 20, ht_HashDJB2, all_engines[n]);
+        TEST_ASSERT_EQUAL(0, ht_setLoadFactor(&ht, loads[n], 0));
+        for (size_t i = 0; i < sa_v.len; i++) {
+            int result = ht_insert(&ht, (unsigned char*)sa_v.arr[i], (void*)sa_v.arr[i]);
+            TEST_ASSERT_EQUAL(0, result);
+        }
+
+        struct timeval begin, end;
+        gettimeofday(&begin, 0);
+        for (size_t i = 0; i < sa_v.len; i++) {
+            if (ht_read(&ht, (unsigned char*)sa_v.arr[i]) != sa_v.arr[i]) {
+                TEST_FAIL_MESSAGE("read returned wrong value");
+            }
+        }
+        gettimeofday(&end, 0);
+        double elapsed = (end.tv_sec - begin.tv_sec) + (end.tv_usec - begin.tv_usec)*1e-6;
+        printf("Reading %lu entities with engine <%s> at load [ %f ] took [ %f_sec ], table takes [ %f_bytes ] per entity\n",
+               sa_v.len, names[n], (double)ht.len/(double)ht.cap, elapsed, (double)tableBytes(&ht)/(double)ht.len);
+
+        ht_free(&ht);
+    }
+    str_arr_free(sa_v);
+}
+
+static void testCuckooHighLoad(void) {
+    StrArr_view sa_v = generate(300*1000);
+
+    HT ht = ht_newEngine(0, ht_HashSDBM, ht_EngineCuckoo);
+    TEST_ASSERT_EQUAL(0, ht_setLoadFactor(&ht, 0.95, 0));
+
+    for (size_t i = 0; i < sa_v.len; i++) {
+        int result = ht_insert(&ht, (unsigned char*)sa_v.arr[i], (void*)sa_v.arr[i]);
+        TEST_ASSERT_EQUAL(0, result);
+    }
+    TEST_ASSERT_EQUAL(sa_v.len, ht.len);
+    TEST_ASSERT_TRUE(ht.stash.len <= 4);
+    for (size_t i = 0; i < sa_v.len; i++) {
+        TEST_ASSERT_EQUAL_PTR(sa_v.arr[i], ht_read(&ht, (unsigned char*)sa_v.arr[i]));
+    }
+
+    ht_free(&ht);
+    str_arr_free(sa_v);
+}
+
+static unsigned long hashConstant(unsigned char *str) {
+    (void)str;
+    return 42;
+}
+
+static void testStashTakesEqualHashes(void) {
+    StrArr_view sa_v = generate(40);
+    ht_Engine stashing[2] = {ht_EngineCuckoo, ht_EngineHopscotch};
+    size_t in_slots[2] = {8, 32};
+
+    // All keys share their slots, growing cannot separate them, so the keys past the slots are stashed.
+    for (size_t e = 0; e < 2; e++) {
+        HT ht = ht_newEngine(0, hashConstant, stashing[e]);
+        size_t cap = ht.cap;
+        for (size_t i = 0; i < sa_v.len; i++) {
+            TEST_ASSERT_EQUAL(0, ht_insert(&ht, (unsigned char*)sa_v.arr[i], (void*)sa_v.arr[i]));
+        }
+        TEST_ASSERT_EQUAL(cap, ht.cap);
+        TEST_ASSERT_EQUAL(sa_v.len - in_slots[e], ht.stash.len);
+        for (size_t i = 0; i < sa_v.len; i++) {
+            TEST_ASSERT_EQUAL_PTR(sa_v.arr[i], ht_read(&ht, (unsigned char*)sa_v.arr[i]));
+        }
+        // Batches of 3 cross from the slots into the stash in the middle of a batch.
+        Entity *batch[3];
+        size_t visited = 0;
+        Iterator it = ht_newIterator();
+        for (size_t n = ht_next_batch(&ht, &it, batch, 3); n; n = ht_next_batch(&ht, &it, batch, 3)) {
+            visited += n;
+        }
+        TEST_ASSERT_EQUAL(sa_v.len, visited);
+        ht_free(&ht);
+    }
+    str_arr_free(sa_v);
+}
+
+static void testHopscotchHighLoad(void) {
+    StrArr_view sa_v = generate(300*1000);
+
+    HT ht = ht_newEngine(0, ht_HashSDBM, ht_EngineHopscotch);
+    TEST_ASSERT_EQUAL(0, ht_setLoadFactor(&ht, 0.95, 0));
+
+    for (size_t i = 0; i < sa_v.len; i++) {
+        int result = ht_insert(&ht, (unsigned char*)sa_v.arr[i], (void*)sa_v.arr[i]);
+        TEST_ASSERT_EQUAL(0, result);
+    }
+    TEST_ASSERT_EQUAL(sa_v.len, ht.len);
+    TEST_ASSERT_TRUE(ht.stash.len <= 4);
+
+    for (size_t i = 0; i < sa_v.len; i += 2) {
+        TEST_ASSERT_EQUAL_PTR(sa_v.arr[i], ht_delete(&ht, (unsigned char*)sa_v.arr[i]));
+    }
+    for (size_t i = 0; i < sa_v.len; i++) {
+        void *expected = i%2 ? (void*)sa_v.arr[i] : NULL;
+        TEST_ASSERT_EQUAL_PTR(expected, ht_read(&ht, (unsigned char*)sa_v.arr[i]));
+    }
+
+    ht_free(&ht);
+    str_arr_free(sa_v);
+}
+
+static void testLengthHashesMatch(void) {
+    StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
+
+    ht_HashFunction hash_functions[5] = {ht_HashDJB2, ht_HashSDBM, ht_HashLL, ht_HashWY, ht_HashHW};
+    ht_HashFunctionN hash_functions_n[5] = {ht_HashDJB2N, ht_HashSDBMN, ht_HashLLN, ht_HashWYN, ht_HashHWN};
+
+    for (size_t n = 0; n < 5; n++) {
+        for (size_t i = 0; i < sa_v.len; i++) {
+            unsigned char *key = (unsigned char*)sa_v.arr[i];
+            size_t len = strlen(sa_v.arr[i]);
+            TEST_ASSERT_EQUAL(hash_functions[n](key), hash_functions_n[n](key, len));
+        }
+    }
+    str_arr_free(sa_v);
+}
+
+static void testBinaryKeysAllEngines(void) {
+    // Keys are every 12 byte window of the buffer, so they overlap, contain NUL bytes and are not terminated.
+    const size_t keys = 20*1000;
+    const size_t key_len = 12;
+    unsigned char *buf = malloc(keys + key_len);
+    uint64_t x = 0x9E3779B97F4A7C15ull;
+    for (size_t i = 0; i < keys + key_len; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        buf[i] = (unsigned char)(x % 4);
+    }
+
+    for (size_t n = 0; n < EngineCount; n++) {
+        HT ht = ht_newEngine(0, ht_HashDJB2, all_engines[n]);
+        size_t distinct = 0;
+        for (size_t i = 0; i < keys; i++) {
+            if (!ht_read_n(&ht, &buf[i], key_len)) {
+                distinct++;
+            }
+            TEST_ASSERT_EQUAL(0, ht_insert_n(&ht, &buf[i], key_len, &buf[i]));
+        }
+        TEST_ASSERT_EQUAL(distinct, ht.len);
+
+        for (size_t i = 0; i < keys; i++) {
+            unsigned char *value = ht_read_n(&ht, &buf[i], key_len);
+            TEST_ASSERT_NOT_NULL(value);
+            TEST_ASSERT_EQUAL_MEMORY(&buf[i], value, key_len);
+            TEST_ASSERT_NULL(ht_read_n(&ht, &buf[i], key_len - 1));
+        }
+        for (size_t i = 0; i < keys; i++) {
+            ht_delete_n(&ht, &buf[i], key_len);
+        }
+        TEST_ASSERT_EQUAL(0, ht.len);
+
+        ht_free(&ht);
+    }
+    free(buf);
+}
+
+static unsigned long hashNoLengthVariant(unsigned char *str) {
+    return ht_HashSDBM(str) ^ 0x5555;
+}
+
+static void testLengthAndStringKeysAgree(void) {
+    StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
+    char long_key[1024];
+    memset(long_key, 'k', sizeof(long_key) - 1);
+    long_key[sizeof(long_key) - 1] = '\0';
+
+    ht_HashFunction hash_functions[2] = {ht_HashSDBM, hashNoLengthVariant};
+
+    for (size_t n = 0; n < 2; n++) {
+        HT ht = ht_new(0, hash_functions[n]);
+        for (size_t i = 0; i < sa_v.len; i++) {
+            int result = ht_insert(&ht, (unsigned char*)sa_v.arr[i], (void*)sa_v.arr[i]);
+            TEST_ASSERT_EQUAL(0, result);
+        }
+        TEST_ASSERT_EQUAL(0, ht_insert_n(&ht, long_key, strlen(long_key), long_key));
+        TEST_ASSERT_EQUAL_PTR(long_key, ht_read(&ht, (unsigned char*)long_key));
+
+        for (size_t i = 0; i < sa_v.len; i++) {
+            TEST_ASSERT_EQUAL_PTR(sa_v.arr[i], ht_read_n(&ht, sa_v.arr[i], strlen(sa_v.arr[i])));
+        }
+        for (size_t i = 0; i < sa_v.len; i++) {
+            TEST_ASSERT_EQUAL_PTR(sa_v.arr[i], ht_delete_n(&ht, sa_v.arr[i], strlen(sa_v.arr[i])));
+            TEST_ASSERT_NULL(ht_read(&ht, (unsigned char*)sa_v.arr[i]));
+        }
+        TEST_ASSERT_EQUAL(1, ht.len);
+
+        ht_free(&ht);
+    }
+    str_arr_free(sa_v);
+}
+
+static void benchHashLengthVariants(void) {
+    const size_t repetitons = 10000;
+    StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
+    size_t *lens = malloc(sa_v.len*sizeof(size_t));
+    for (size_t i = 0; i < sa_v.len; i++) {
+        lens[i] = strlen(sa_v.arr[i]);
+    }
+
+    ht_HashFunctionN hash_functions_n[4] = {ht_HashDJB2N, ht_HashSDBMN, ht_HashLLN, ht_HashWYN};
+    char names[4][14] = {"ht_HashDJB2N", "ht_HashSDBMN", "ht_HashLLN", "ht_HashWYN"};
+
+    for (size_t n = 0; n < 4; n++) {
+        struct timeval begin, end;
+        gettimeofday(&begin, 0);
+
+        size_t counter = 0;
+        unsigned long sink = 0;
+        for (size_t rep = 0; rep < repetitons; rep++) {
+            for (size_t i = 0; i < sa_v.len; i++) {
+                sink += hash_functions_n[n](sa_v.arr[i], lens[i]);
+                counter++;
+            }
+        }
+
+        gettimeofday(&end, 0);
+        long seconds = end.tv_sec - begin.tv_sec;
+        long microseconds = end.tv_usec - begin.tv_usec;
+        double elapsed = seconds + microseconds*1e-6;
+        printf("%s calculating %zu hashes took [ %f_sec ] (%lx)\n", names[n], counter, elapsed, sink);
+    }
+
+    free(lens);
+    str_arr_free(sa_v);
+}
+
+static void testHashWYSpreadsAllBits(void) {
+    // Every length takes a different load path, a flipped input bit must flip about half of the hash bits.
+    unsigned char key[128];
+    for (size_t i = 0; i < sizeof(key); i++) {
+        key[i] = (unsigned char)(i*131 + 7);
+    }
+    for (size_t len = 1; len <= sizeof(key); len++) {
+        unsigned long h = ht_HashWYN(key, len);
+        size_t flipped = 0;
+        for (size_t bit = 0; bit < len*8; bit++) {
+            key[bit/8] ^= (unsigned char)(1u << (bit%8));
+            for (unsigned long diff = h ^ ht_HashWYN(key, len); diff; diff &= diff - 1) {
+                flipped++;
+            }
+            key[bit/8] ^= (unsigned char)(1u << (bit%8));
+        }
+        double avg = (double)flipped/(double)(len*8);
+        TEST_ASSERT_TRUE(avg > 24 && avg < 40);
+        TEST_ASSERT_NOT_EQUAL(h, ht_HashWYN(key, len - 1));
+    }
+}
+
+static void benchHashThroughputByKeyLength(void) {
+    const size_t budget = 32*1024*1024;
+    size_t lens[7] = {4, 8, 16, 32, 64, 256, 1024};
+    ht_HashFunctionN hash_functions_n[5] = {ht_HashDJB2N, ht_HashSDBMN, ht_HashLLN, ht_HashWYN, ht_HashHWN};
+    char names[5][14] = {"ht_HashDJB2N", "ht_HashSDBMN", "ht_HashLLN", "ht_HashWYN", "ht_HashHWN"};
+
+    unsigned char *buf = malloc(budget/4 + 1024);
+    for (size_t i = 0; i < budget/4 + 1024; i++) {
+        buf[i] = (unsigned char)('a' + i*7919%26);
+    }
+
+    for (size_t l = 0; l < 7; l++) {
+        size_t keys = budget/4/lens[l];
+        for (size_t n = 0; n < 5; n++) {
+            struct timeval begin, end;
+            gettimeofday(&begin, 0);
+
+            unsigned long sink = 0;
+            for (size_t rep = 0; rep < 4; rep++) {
+                for (size_t i = 0; i < keys; i++) {
+                    sink += hash_functions_n[n](&buf[i*lens[l]], lens[l]);
+                }
+            }
+
+            gettimeofday(&end, 0);
+            long seconds = end.tv_sec - begin.tv_sec;
+            long microseconds = end.tv_usec - begin.tv_usec;
+            double elapsed = seconds + microseconds*1e-6;
+            printf("%s hashing %zu keys of %zu bytes took [ %f_sec ], [ %f_MB/sec ] (%lx)\n",
+                   names[n], 4*keys, lens[l], elapsed, (double)(4*keys*lens[l])/elapsed/1e6, sink);
+        }
+    }
+    free(buf);
+}
+
+static void testHashHWSpreadsAllBits(void) {
+    unsigned char key[128];
+    unsigned char shifted[129];
+    for (size_t i = 0; i < sizeof(key); i++) {
+        key[i] = (unsigned char)(i*131 + 7);
+    }
+    for (size_t len = 1; len <= sizeof(key); len++) {
+        unsigned long h = ht_HashHWN(key, len);
+        memcpy(&shifted[1], key, len);
+        TEST_ASSERT_EQUAL(h, ht_HashHWN(&shifted[1], len));
+        TEST_ASSERT_NOT_EQUAL(h, ht_HashHWN(key, len - 1));
+
+        size_t flipped = 0;
+        for (size_t bit = 0; bit < len*8; bit++) {
+            key[bit/8] ^= (unsigned char)(1u << (bit%8));
+            for (unsigned long diff = h ^ ht_HashHWN(key, len); diff; diff &= diff - 1) {
+                flipped++;
+            }
+            key[bit/8] ^= (unsigned char)(1u << (bit%8));
+        }
+        double avg = (double)flipped/(double)(len*8);
+        TEST_ASSERT_TRUE(avg > 24 && avg < 40);
+    }
+}
+
+// anagrams writes all permutations of the first 8 letters, they share the ht_HashLL hash.
+static StrArr_view anagrams(void) {
+    StrArr_view sa_v = {.arr = calloc(40320, sizeof(char*)), .len = 0};
+    char word[9] = "abcdefgh";
+    size_t c[8] = {0};
+    sa_v.arr[sa_v.len++] = strdup(word);
+    for (size_t i = 1; i < 8;) {
+        if (c[i] < i) {
+            size_t j = i%2 ? c[i] : 0;
+            char tmp = word[j];
+            word[j] = word[i];
+            word[i] = tmp;
+            sa_v.arr[sa_v.len++] = strdup(word);
+            c[i]++;
+            i = 1;
+        } else {
+            c[i] = 0;
+            i++;
+        }
+    }
+    return sa_v;
+}
+
+static size_t longestBucket(HT *ht) {
+    size_t longest = 0;
+    for (size_t i = 0; i < ht->cap; i++) {
+        if (ht->table[i].len > longest) {
+            longest = ht->table[i].len;
+        }
+    }
+    return longest;
+}
+
+static void testSeededAllEngines(void) {
+    StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
+
+    for (size_t n = 0; n < EngineCount; n++) {
+        HT ht = ht_newSeeded(0, ht_HashSip13, all_engines[n]);
+        for (size_t i = 0; i < sa_v.len; i++) {
+            TEST_ASSERT_EQUAL(0, ht_insert(&ht, (unsigned char*)sa_v.arr[i], (void*)sa_v.arr[i]));
+        }
+        TEST_ASSERT_EQUAL(sa_v.len, ht.len);
+        for (size_t i = 0; i < sa_v.len; i++) {
+            TEST_ASSERT_EQUAL_PTR(sa_v.arr[i], ht_read_n(&ht, sa_v.arr[i], strlen(sa_v.arr[i])));
+        }
+        for (size_t i = 0; i < sa_v.len; i++) {
+            TEST_ASSERT_EQUAL_PTR(sa_v.arr[i], ht_delete(&ht, (unsigned char*)sa_v.arr[i]));
+        }
+        TEST_ASSERT_EQUAL(0, ht.len);
+        ht_free(&ht);
+    }
+    str_arr_free(sa_v);
+}
+
+static void testSeedIsPerTable(void) {
+    unsigned char key[] = "seeded";
+    ht_Seed seed = {0x0706050403020100ull, 0x0F0E0D0C0B0A0908ull};
+
+    HT a = ht_newSeeded(0, ht_HashSip13, ht_EngineChained);
+    HT b = ht_newSeeded(0, ht_HashSip13, ht_EngineChained);
+    TEST_ASSERT_FALSE(a.seed.k0 == b.seed.k0 && a.seed.k1 == b.seed.k1);
+    TEST_ASSERT_EQUAL(0, ht_insert(&a, key, key));
+    TEST_ASSERT_EQUAL(ht_ErrCannotInsert, ht_setSeed(&a, seed));
+
+    TEST_ASSERT_EQUAL(0, ht_setSeed(&b, seed));
+    TEST_ASSERT_EQUAL(0, ht_insert(&b, key, key));
+    Iterator it = ht_newIterator();
+    TEST_ASSERT_EQUAL(ht_HashSip13(key, strlen((char*)key), &seed), ht_next(&b, &it)->hash);
+
+    ht_free(&a);
+    ht_free(&b);
+}
+
+static void testSeededHashSpreadsCollidingKeys(void) {
+    StrArr_view sa_v = anagrams();
+
+    HT ht = ht_newSeeded(0, ht_HashSip13, ht_EngineChained);
+    for (size_t i = 0; i < sa_v.len; i++) {
+        TEST_ASSERT_EQUAL(0, ht_insert(&ht, (unsigned char*)sa_v.arr[i], (void*)sa_v.arr[i]));
+    }
+    TEST_ASSERT_EQUAL(sa_v.len, ht.len);
+    TEST_ASSERT_TRUE(longestBucket(&ht) < 16);
+
+    ht_free(&ht);
+    str_arr_free(sa_v);
+}
+
+static void benchInsertCollidingKeys(void) {
+    StrArr_view sa_v = anagrams();
+    const size_t keys = 20*1000;
+
+    for (size_t n = 0; n < 2; n++) {
+        HT ht = n ? ht_newSeeded(0, ht_HashSip13, ht_EngineChained) : ht_new(0, ht_HashLL);
+
+        struct timeval begin, end;
+        gettimeofday(&begin, 0);
+
+        for (size_t i = 0; i < keys; i++) {
+            int result = ht_insert(&ht, (unsigned char*)sa_v.arr[i], (void*)sa_v.arr[i]);
+            TEST_ASSERT_EQUAL(0, result);
+        }
+
+        gettimeofday(&end, 0);
+        long seconds = end.tv_sec - begin.tv_sec;
+        long microseconds = end.tv_usec - begin.tv_usec;
+        double elapsed = seconds + microseconds*1e-6;
+        printf("Inserting %zu anagram keys with hash function <%s> took [ %f_sec ], longest bucket [ %zu ]\n",
+               keys, n ? "siphash-1-3" : "loss loss", elapsed, longestBucket(&ht));
+
+        ht_free(&ht);
+    }
+    str_arr_free(sa_v);
+}
+
+static void testHashBatchMatchesScalar(void) {
+    StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
+    ht_HashFunctionN hash_functions_n[5] = {ht_HashDJB2N, ht_HashSDBMN, ht_HashLLN, ht_HashWYN, ht_HashHWN};
+
+    // The passwords are followed by binary keys of every length up to 40, so lanes end at every position.
+    size_t n = sa_v.len + 41;
+    const void **keys = malloc(n*sizeof(void*));
+    size_t *lens = malloc(n*sizeof(size_t));
+    unsigned long *hashes = malloc(n*sizeof(unsigned long));
+    unsigned char binary[40];
+    for (size_t i = 0; i < sizeof(binary); i++) {
+        binary[i] = (unsigned char)(255 - i*3);
+    }
+    for (size_t i = 0; i < sa_v.len; i++) {
+        keys[i] = sa_v.arr[i];
+        lens[i] = strlen(sa_v.arr[i]);
+    }
+    for (size_t i = 0; i <= sizeof(binary); i++) {
+        keys[sa_v.len + i] = binary;
+        lens[sa_v.len + i] = i;
+    }
+
+    for (size_t f = 0; f < 5; f++) {
+        for (size_t count = n - 7; count <= n; count++) {
+            memset(hashes, 0, n*sizeof(unsigned long));
+            ht_hash_batch(hash_functions_n[f], keys, lens, hashes, count);
+            for (size_t i = 0; i < count; i++) {
+                TEST_ASSERT_EQUAL(hash_functions_n[f](keys[i], lens[i]), hashes[i]);
+            }
+        }
+    }
+
+    free(keys);
+    free(lens);
+    free(hashes);
+    str_arr_free(sa_v);
+}
+
+static void benchHashBatch(void) {
+    const size_t repetitons = 10000;
+    StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
+    const void **keys = malloc(sa_v.len*sizeof(void*));
+    size_t *lens = malloc(sa_v.len*sizeof(size_t));
+    unsigned long *hashes = malloc(sa_v.len*sizeof(unsigned long));
+    for (size_t i = 0; i < sa_v.len; i++) {
+        keys[i] = sa_v.arr[i];
+        lens[i] = strlen(sa_v.arr[i]);
+    }
+
+    ht_HashFunctionN hash_functions_n[3] = {ht_HashDJB2N, ht_HashSDBMN, ht_HashLLN};
+    char names[3][14] = {"ht_HashDJB2N", "ht_HashSDBMN", "ht_HashLLN"};
+
+    for (size_t n = 0; n < 3; n++) {
+        struct timeval begin, end;
+        gettimeofday(&begin, 0);
+
+        size_t counter = 0;
+        unsigned long sink = 0;
+        for (size_t rep = 0; rep < repetitons; rep++) {
+            ht_hash_batch(hash_functions_n[n], keys, lens, hashes, sa_v.len);
+            sink += hashes[rep%sa_v.len];
+            counter += sa_v.len;
+        }
+
+        gettimeofday(&end, 0);
+        long seconds = end.tv_sec - begin.tv_sec;
+        long microseconds = end.tv_usec - begin.tv_usec;
+        double elapsed = seconds + microseconds*1e-6;
+        printf("%s batch calculating %zu hashes took [ %f_sec ] (%lx)\n", names[n], counter, elapsed, sink);
+    }
+
+    free(keys);
+    free(lens);
+    free(hashes);
+    str_arr_free(sa_v);
+}
+
+
+// stridedHash steps the hash of 8 byte counters by the inverse of the golden ratio multiplier,
+// so the index multiply maps consecutive counters to neighbouring buckets of a large table.
+static unsigned long stridedHash(const void *key, size_t len) {
+    uint64_t inverse = 0x9E3779B97F4A7C15ull;
+    for (int i = 0; i < 5; i++) {
+        inverse *= 2 - 0x9E3779B97F4A7C15ull*inverse;
+    }
+    uint64_t counter = 0;
+    memcpy(&counter, key, len < sizeof(counter) ? len : sizeof(counter));
+    return (unsigned long)(counter*inverse);
+}
+
+static void testFinalizerSpreadsWeakHash(void) {
+    const size_t keys = 20*1000;
+    uint64_t *counters = malloc(keys*sizeof(uint64_t));
+    for (size_t i = 0; i < keys; i++) {
+        counters[i] = i;
+    }
+
+    for (int finalize = 0; finalize < 2; finalize++) {
+        HT ht = ht_new(0, ht_HashDJB2);
+        TEST_ASSERT_EQUAL(0, ht_setHashFunctionN(&ht, stridedHash));
+        TEST_ASSERT_EQUAL(0, ht_setFinalizer(&ht, finalize));
+        for (size_t i = 0; i < keys; i++) {
+            TEST_ASSERT_EQUAL(0, ht_insert_n(&ht, &counters[i], sizeof(uint64_t), &counters[i]));
+        }
+        for (size_t i = 0; i < keys; i++) {
+            TEST_ASSERT_EQUAL_PTR(&counters[i], ht_read_n(&ht, &counters[i], sizeof(uint64_t)));
+        }
+        if (finalize) {
+            TEST_ASSERT_TRUE(longestBucket(&ht) < 16);
+        } else {
+            TEST_ASSERT_TRUE(longestBucket(&ht) > 1000);
+        }
+        ht_free(&ht);
+    }
+    free(counters);
+}
+
+static void testFinalizerAllEngines(void) {
+    StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
+    unsigned char key[] = "finalized";
+
+    for (size_t n = 0; n < EngineCount; n++) {
+        HT ht = ht_newEngine(0, ht_HashLL, all_engines[n]);
+        TEST_ASSERT_EQUAL(0, ht_setFinalizer(&ht, 1));
+        for (size_t i = 0; i < sa_v.len; i++) {
+            TEST_ASSERT_EQUAL(0, ht_insert(&ht, (unsigned char*)sa_v.arr[i], (void*)sa_v.arr[i]));
+        }
+        TEST_ASSERT_EQUAL(sa_v.len, ht.len);
+        TEST_ASSERT_EQUAL(ht_ErrCannotInsert, ht_setFinalizer(&ht, 0));
+        for (size_t i = 0; i < sa_v.len; i++) {
+            TEST_ASSERT_EQUAL_PTR(sa_v.arr[i], ht_read(&ht, (unsigned char*)sa_v.arr[i]));
+        }
+        for (size_t i = 0; i < sa_v.len; i++) {
+            TEST_ASSERT_EQUAL_PTR(sa_v.arr[i], ht_delete(&ht, (unsigned char*)sa_v.arr[i]));
+        }
+        TEST_ASSERT_EQUAL(0, ht.len);
+
+        TEST_ASSERT_EQUAL(0, ht_insert(&ht, key, key));
+        Iterator it = ht_newIterator();
+        TEST_ASSERT_NOT_EQUAL(ht_HashLL(key), ht_next(&ht, &it)->hash);
+        ht_free(&ht);
+    }
+    str_arr_free(sa_v);
+}
+
+static size_t counted_hashes;
+
+static unsigned long countingHash(const void *key, size_t len) {
+    counted_hashes++;
+    return ht_HashDJB2N(key, len);
+}
+
+static void testKeyHandleSkipsHashing(void) {
+    StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
+    ht_Engine engines[3] = {ht_EngineChained, ht_EngineSwiss, ht_EngineRobinHood};
+    HT tables[3];
+    for (size_t t = 0; t < 3; t++) {
+        tables[t] = ht_newEngine(0, ht_HashDJB2, engines[t]);
+        TEST_ASSERT_EQUAL(0, ht_setHashFunctionN(&tables[t], countingHash));
+    }
+    ht_Key *keys = malloc(sa_v.len*sizeof(ht_Key));
+
+    counted_hashes = 0;
+    for (size_t i = 0; i < sa_v.len; i++) {
+        keys[i] = ht_key_make(&tables[0], sa_v.arr[i], strlen(sa_v.arr[i]));
+        TEST_ASSERT_EQUAL(ht_HashDJB2((unsigned char*)sa_v.arr[i]), keys[i].hash);
+    }
+    TEST_ASSERT_EQUAL(sa_v.len, counted_hashes);
+
+    for (size_t t = 0; t < 3; t++) {
+        for (size_t i = 0; i < sa_v.len; i++) {
+            TEST_ASSERT_EQUAL(0, ht_insert_key(&tables[t], &keys[i], sa_v.arr[i]));
+        }
+        TEST_ASSERT_EQUAL(sa_v.len, tables[t].len);
+        for (size_t i = 0; i < sa_v.len; i++) {
+            TEST_ASSERT_EQUAL_PTR(sa_v.arr[i], ht_read_key(&tables[t], &keys[i]));
+        }
+        for (size_t i = 0; i < sa_v.len; i += 2) {
+            TEST_ASSERT_EQUAL_PTR(sa_v.arr[i], ht_delete_key(&tables[t], &keys[i]));
+        }
+    }
+    TEST_ASSERT_EQUAL(sa_v.len, counted_hashes);
+
+    for (size_t i = 0; i < sa_v.len; i++) {
+        void *expected = i%2 ? sa_v.arr[i] : NULL;
+        TEST_ASSERT_EQUAL_PTR(expected, ht_read(&tables[1], (unsigned char*)sa_v.arr[i]));
+    }
+
+    for (size_t t = 0; t < 3; t++) {
+        ht_free(&tables[t]);
+    }
+    free(keys);
+    str_arr_free(sa_v);
+}
+
+static void testKeyHandleRehashesForOtherTables(void) {
+    unsigned char key[] = "handle";
+    HT made = ht_new(0, ht_HashDJB2);
+    HT other = ht_new(0, ht_HashSDBM);
+    HT finalized = ht_new(0, ht_HashDJB2);
+    HT seeded_a = ht_newSeeded(0, ht_HashSip13, ht_EngineChained);
+    HT seeded_b = ht_newSeeded(0, ht_HashSip13, ht_EngineChained);
+    TEST_ASSERT_EQUAL(0, ht_setFinalizer(&finalized, 1));
+
+    ht_Key k = ht_key_make(&made, key, strlen((char*)key));
+    ht_Key ks = ht_key_make(&seeded_a, key, strlen((char*)key));
+    HT *tables[4] = {&other, &finalized, &seeded_a, &seeded_b};
+    for (size_t t = 0; t < 4; t++) {
+        TEST_ASSERT_EQUAL(0, ht_insert_key(tables[t], &k, key));
+        TEST_ASSERT_EQUAL_PTR(key, ht_read(tables[t], key));
+        TEST_ASSERT_EQUAL_PTR(key, ht_read_key(tables[t], &ks));
+        TEST_ASSERT_EQUAL_PTR(key, ht_delete_key(tables[t], &ks));
+        TEST_ASSERT_NULL(ht_read_key(tables[t], &k));
+        ht_free(tables[t]);
+    }
+    ht_free(&made);
+}
+
+static void benchReadKeyAcrossTables(void) {
+    const size_t repetitons = 100;
+    StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
+    HT tables[4];
+    for (size_t t = 0; t < 4; t++) {
+        tables[t] = ht_new(0, ht_HashWY);
+        for (size_t i = 0; i < sa_v.len; i++) {
+            ht_insert(&tables[t], (unsigned char*)sa_v.arr[i], sa_v.arr[i]);
+        }
+    }
+
+    for (size_t n = 0; n < 2; n++) {
+        struct timeval begin, end;
+        gettimeofday(&begin, 0);
+
+        size_t found = 0;
+        for (size_t rep = 0; rep < repetitons; rep++) {
+            for (size_t i = 0; i < sa_v.len; i++) {
+                size_t len = strlen(sa_v.arr[i]);
+                ht_Key k = ht_key_make(&tables[0], sa_v.arr[i], len);
+                for (size_t t = 0; t < 4; t++) {
+                    found += (n ? ht_read_key(&tables[t], &k) : ht_read_n(&tables[t], sa_v.arr[i], len)) != NULL;
+                }
+            }
+        }
+
+        gettimeofday(&end, 0);
+        long seconds = end.tv_sec - begin.tv_sec;
+        long microseconds = end.tv_usec - begin.tv_usec;
+        double elapsed = seconds + microseconds*1e-6;
+        printf("Reading %zu entities from 4 tables %s took [ %f_sec ]\n",
+               found, n ? "with a key handle" : "hashing every read", elapsed);
+    }
+
+    for (size_t t = 0; t < 4; t++) {
+        ht_free(&tables[t]);
+    }
+    str_arr_free(sa_v);
+}
+
+static void testEntryCountsAllEngines(void) {
+    StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
+
+    for (size_t n = 0; n < EngineCount; n++) {
+        HT ht = ht_newEngine(0, ht_HashWY, all_engines[n]);
+        for (uintptr_t round = 1; round <= 3; round++) {
+            for (size_t i = 0; i < sa_v.len; i++) {
+                int inserted = -1;
+                void **slot = ht_entry(&ht, (unsigned char*)sa_v.arr[i], &inserted);
+                TEST_ASSERT_NOT_NULL(slot);
+                TEST_ASSERT_EQUAL(round == 1, inserted);
+                TEST_ASSERT_EQUAL(round - 1, (uintptr_t)*slot);
+                *slot = (void*)((uintptr_t)*slot + 1);
+            }
+        }
+        TEST_ASSERT_EQUAL(sa_v.len, ht.len);
+        for (size_t i = 0; i < sa_v.len; i++) {
+            TEST_ASSERT_EQUAL(3, (uintptr_t)ht_read(&ht, (unsigned char*)sa_v.arr[i]));
+            void **slot = ht_entry_n(&ht, sa_v.arr[i], strlen(sa_v.arr[i]), NULL);
+            TEST_ASSERT_EQUAL(3, (uintptr_t)*slot);
+        }
+        ht_free(&ht);
+    }
+    str_arr_free(sa_v);
+}
+
+static void *appendTrace(void *value, int inserted, void *ctx) {
+    size_t *calls = ctx;
+    (*calls)++;
+    return (void*)((uintptr_t)value*10 + (uintptr_t)(inserted ? 1 : 2));
+}
+
+static void testGetOrInsertAndUpdateWith(void) {
+    unsigned char first[] = "first";
+    unsigned char second[] = "second";
+    HT ht = ht_new(0, ht_HashDJB2);
+
+    TEST_ASSERT_EQUAL_PTR(first, ht_get_or_insert(&ht, first, first));
+    TEST_ASSERT_EQUAL_PTR(first, ht_get_or_insert(&ht, first, second));
+    TEST_ASSERT_EQUAL(1, ht.len);
+
+    size_t calls = 0;
+    TEST_ASSERT_EQUAL(0, ht_update_with(&ht, second, appendTrace, &calls));
+    TEST_ASSERT_EQUAL(0, ht_update_with(&ht, second, appendTrace, &calls));
+    TEST_ASSERT_EQUAL(0, ht_update_with(&ht, second, appendTrace, &calls));
+    TEST_ASSERT_EQUAL(3, calls);
+    TEST_ASSERT_EQUAL(122, (uintptr_t)ht_read(&ht, second));
+    TEST_ASSERT_EQUAL(2, ht.len);
+    TEST_ASSERT_EQUAL(ht_ErrDoNotExists, ht_update_with(&ht, second, NULL, &calls));
+
+    ht_free(&ht);
+}
+
+static void benchCountingReadInsertVsEntry(void) {
+    const size_t repetitons = 100;
+    StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
+
+    for (size_t n = 0; n < 2; n++) {
+        HT ht = ht_new(0, ht_HashDJB2);
+        struct timeval begin, end;
+        gettimeofday(&begin, 0);
+
+        for (size_t rep = 0; rep < repetitons; rep++) {
+            for (size_t i = 0; i < sa_v.len; i++) {
+                unsigned char *key = (unsigned char*)sa_v.arr[i];
+                if (n) {
+                    void **slot = ht_entry(&ht, key, NULL);
+                    *slot = (void*)((uintptr_t)*slot + 1);
+                } else {
+                    ht_insert(&ht, key, (void*)((uintptr_t)ht_read(&ht, key) + 1));
+                }
+            }
+        }
+
+        gettimeofday(&end, 0);
+        long seconds = end.tv_sec - begin.tv_sec;
+        long microseconds = end.tv_usec - begin.tv_usec;
+        double elapsed = seconds + microseconds*1e-6;
+        printf("Counting %zu keys with %s took [ %f_sec ]\n",
+               repetitons*sa_v.len, n ? "ht_entry" : "ht_read and ht_insert", elapsed);
+        TEST_ASSERT_EQUAL(repetitons, (uintptr_t)ht_read(&ht, (unsigned char*)sa_v.arr[0]));
+
+        ht_free(&ht);
+    }
+    str_arr_free(sa_v);
+}
+
+static void testInsertReplaceReturnsDisplaced(void) {
+    StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
+
+    for (size_t n = 0; n < EngineCount; n++) {
+        HT ht = ht_newEngine(0, ht_HashDJB2, all_engines[n]);
+        for (size_t round = 0; round < 3; round++) {
+            for (size_t i = 0; i < sa_v.len; i++) {
+                char *value = strdup(sa_v.arr[i]);
+                void *replaced = value;
+                TEST_ASSERT_EQUAL(0, ht_insert_replace(&ht, (unsigned char*)sa_v.arr[i], value, &replaced));
+                if (round == 0) {
+                    TEST_ASSERT_NULL(replaced);
+                } else {
+                    TEST_ASSERT_NOT_NULL(replaced);
+                    TEST_ASSERT_EQUAL_STRING(sa_v.arr[i], replaced);
+                    TEST_ASSERT_TRUE(replaced != value);
+                    free(replaced);
+                }
+            }
+        }
+        TEST_ASSERT_EQUAL(sa_v.len, ht.len);
+        for (size_t i = 0; i < sa_v.len; i++) {
+            free(ht_delete(&ht, (unsigned char*)sa_v.arr[i]));
+        }
+        TEST_ASSERT_EQUAL(0, ht.len);
+        ht_free(&ht);
+    }
+    str_arr_free(sa_v);
+}
+
+static void testInsertNewAllEngines(void) {
+    StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
+
+    for (size_t n = 0; n < EngineCount; n++) {
+        HT ht = ht_newEngine(0, ht_HashWY, all_engines[n]);
+        TEST_ASSERT_EQUAL(0, ht_setRehashStep(&ht, n == 0 ? 4 : 0));
+        for (size_t i = 0; i < sa_v.len; i++) {
+            TEST_ASSERT_EQUAL(0, ht_insert_new(&ht, (unsigned char*)sa_v.arr[i], (void*)sa_v.arr[i]));
+        }
+        TEST_ASSERT_EQUAL(sa_v.len, ht.len);
+        for (size_t i = 0; i < sa_v.len; i++) {
+            TEST_ASSERT_EQUAL_PTR(sa_v.arr[i], ht_read(&ht, (unsigned char*)sa_v.arr[i]));
+        }
+        for (size_t i = 0; i < sa_v.len; i++) {
+            TEST_ASSERT_EQUAL_PTR(sa_v.arr[i], ht_delete(&ht, (unsigned char*)sa_v.arr[i]));
+        }
+        TEST_ASSERT_EQUAL(0, ht.len);
+        ht_free(&ht);
+    }
+    str_arr_free(sa_v);
+}
+
+static void benchInsertNewVsInsert(void) {
+    StrArr_view sa_v = anagrams();
+    ht_Engine engines[2] = {ht_EngineChained, ht_EngineSwiss};
+    char names[2][8] = {"chained", "swiss"};
+
+    for (size_t e = 0; e < 2; e++) {
+        for (size_t n = 0; n < 2; n++) {
+            // The table is presized, so the time goes to the insertions and not to the resizes.
+            HT ht = ht_newEngine(sa_v.len*2, ht_HashWY, engines[e]);
+            struct timeval begin, end;
+            gettimeofday(&begin, 0);
+
+            for (size_t i = 0; i < sa_v.len; i++) {
+                unsigned char *key = (unsigned char*)sa_v.arr[i];
+                if (n) {
+                    ht_insert_new(&ht, key, key);
+                } else {
+                    ht_insert(&ht, key, key);
+                }
+            }
+
+            gettimeofday(&end, 0);
+            long seconds = end.tv_sec - begin.tv_sec;
+            long microseconds = end.tv_usec - begin.tv_usec;
+            double elapsed = seconds + microseconds*1e-6;
+            printf("Loading %zu unique keys into %s engine with %s took [ %f_sec ]\n",
+                   ht.len, names[e], n ? "ht_insert_new" : "ht_insert", elapsed);
+
+            ht_free(&ht);
+        }
+    }
+    str_arr_free(sa_v);
+}
+
+static void testReadBatchAllEngines(void) {
+    StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
+    void **values = malloc(sa_v.len*sizeof(void*));
+
+    // The variants cover the vector hashed, the seeded, the finalized and the incrementally rehashed tables.
+    for (size_t variant = 0; variant < 4; variant++) {
+        for (size_t n = 0; n < EngineCount; n++) {
+            HT ht = variant == 1 ? ht_newSeeded(0, ht_HashSip13, all_engines[n]) : ht_newEngine(0, ht_HashDJB2, all_engines[n]);
+            TEST_ASSERT_EQUAL(0, ht_setFinalizer(&ht, variant == 2));
+            TEST_ASSERT_EQUAL(0, ht_setRehashStep(&ht, variant == 3 ? 2 : 0));
+            for (size_t i = 0; i < sa_v.len; i += 2) {
+                TEST_ASSERT_EQUAL(0, ht_insert(&ht, (unsigned char*)sa_v.arr[i], (void*)sa_v.arr[i]));
+            }
+            size_t count = sa_v.len - 7;
+            size_t found = ht_read_batch(&ht, (unsigned char**)sa_v.arr, count, values);
+            TEST_ASSERT_EQUAL((count + 1)/2, found);
+            for (size_t i = 0; i < count; i++) {
+                TEST_ASSERT_EQUAL_PTR(i%2 ? NULL : sa_v.arr[i], values[i]);
+            }
+            ht_free(&ht);
+        }
+    }
+    free(values);
+    str_arr_free(sa_v);
+}
+
+static void benchReadBatchLargeTable(void) {
+    const size_t keys = 4*1000*1000;
+    const size_t batch = 256;
+    StrArr_view sa_v = generate(keys);
+    StrArr_view order = {
+        .arr = malloc(keys*sizeof(char*)),
+        .len = keys
+    };
+    memcpy(order.arr, sa_v.arr, keys*sizeof(char*));
+    shuffle(order);
+    void **values = malloc(batch*sizeof(void*));
+
+    ht_Engine engines[2] = {ht_EngineChained, ht_EngineSwiss};
+    char names[2][8] = {"chained", "swiss"};
+
+    for (size_t e = 0; e < 2; e++) {
+        HT ht = ht_newEngine(keys, ht_HashWY, engines[e]);
+        for (size_t i = 0; i < keys; i++) {
+            ht_insert_new(&ht, (unsigned char*)sa_v.arr[i], (void*)sa_v.arr[i]);
+        }
+        for (size_t n = 0; n < 2; n++) {
+            struct timeval begin, end;
+            gettimeofday(&begin, 0);
+
+            size_t found = 0;
+            for (size_t i = 0; i < keys; i += batch) {
+                size_t m = keys - i < batch ? keys - i : batch;
+                if (n) {
+                    found += ht_read_batch(&ht, (unsigned char**)&order.arr[i], m, values);
+                    continue;
+                }
+                for (size_t j = 0; j < m; j++) {
+                    found += ht_read(&ht, (unsigned char*)order.arr[i + j]) != NULL;
+                }
+            }
+
+            gettimeofday(&end, 0);
+            long seconds = end.tv_sec - begin.tv_sec;
+            long microseconds = end.tv_usec - begin.tv_usec;
+            double elapsed = seconds + microseconds*1e-6;
+            printf("Reading %zu keys in random order from %s table of %zu MB %s took [ %f_sec ]\n",
+                   found, names[e], (tableBytes(&ht) + keys*32)/(1024*1024),
+                   n ? "with ht_read_batch" : "with ht_read", elapsed);
+        }
+        ht_free(&ht);
+    }
+    free(values);
+    free(order.arr);
+    str_arr_free(sa_v);
+}
+
+static void testInsertBatchAllEngines(void) {
+    StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
+    const size_t repeated = 10;
+    size_t n = sa_v.len + repeated;
+    unsigned char **keys = malloc(n*sizeof(unsigned char*));
+    void **values = malloc(n*sizeof(void*));
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = (unsigned char*)sa_v.arr[i%sa_v.len];
+        values[i] = (void*)(uintptr_t)(i + 1);
+    }
+
+    for (size_t e = 0; e < EngineCount; e++) {
+        // Half of the keys are in the table already, the chained one still migrating them, and some repeat in the batch.
+        HT ht = ht_newEngine(0, ht_HashDJB2, all_engines[e]);
+        TEST_ASSERT_EQUAL(0, ht_setRehashStep(&ht, e == 0 ? 1 : 0));
+        for (size_t i = 0; i < sa_v.len; i += 2) {
+            TEST_ASSERT_EQUAL(0, ht_insert(&ht, (unsigned char*)sa_v.arr[i], NULL));
+        }
+        TEST_ASSERT_EQUAL(0, ht_insert_batch(&ht, keys, values, n, 0));
+        TEST_ASSERT_EQUAL(sa_v.len, ht.len);
+        for (size_t i = 0; i < sa_v.len; i++) {
+            uintptr_t expected = i < repeated ? sa_v.len + i + 1 : i + 1;
+            TEST_ASSERT_EQUAL(expected, (uintptr_t)ht_read(&ht, (unsigned char*)sa_v.arr[i]));
+        }
+        ht_free(&ht);
+
+        ht = ht_newEngine(0, ht_HashWY, all_engines[e]);
+        TEST_ASSERT_EQUAL(0, ht_insert_batch(&ht, keys, values, sa_v.len, ht_BatchUnique));
+        TEST_ASSERT_EQUAL(sa_v.len, ht.len);
+        for (size_t i = 0; i < sa_v.len; i++) {
+            TEST_ASSERT_EQUAL(i + 1, (uintptr_t)ht_read(&ht, (unsigned char*)sa_v.arr[i]));
+        }
+        for (size_t i = 0; i < sa_v.len; i++) {
+            TEST_ASSERT_EQUAL(i + 1, (uintptr_t)ht_delete(&ht, (unsigned char*)sa_v.arr[i]));
+        }
+        TEST_ASSERT_EQUAL(0, ht.len);
+        ht_free(&ht);
+    }
+    free(keys);
+    free(values);
+    str_arr_free(sa_v);
+}
+
+static void benchInsertBatchColdStart(void) {
+    const size_t keys = 2*1000*1000;
+    StrArr_view sa_v = generate(keys);
+    char names[3][36] = {"ht_insert", "ht_insert_batch", "ht_insert_batch with ht_BatchUnique"};
+
+    for (size_t n = 0; n < 3; n++) {
+        struct timeval begin, end;
+        gettimeofday(&begin, 0);
+
+        HT ht = ht_new(0, ht_HashWY);
+        if (n) {
+            ht_insert_batch(&ht, (unsigned char**)sa_v.arr, (void**)sa_v.arr, keys, n == 2 ? ht_BatchUnique : 0);
+        } else {
+            for (size_t i = 0; i < keys; i++) {
+                ht_insert(&ht, (unsigned char*)sa_v.arr[i], sa_v.arr[i]);
+            }
+        }
+
+        gettimeofday(&end, 0);
+        long seconds = end.tv_sec - begin.tv_sec;
+        long microseconds = end.tv_usec - begin.tv_usec;
+        double elapsed = seconds + microseconds*1e-6;
+        printf("Loading %zu keys into an empty table with %s took [ %f_sec ]\n", ht.len, names[n], elapsed);
+
+        ht_free(&ht);
+    }
+    str_arr_free(sa_v);
+}
+
+static void testInsertBatchGrowsForAbsentKeys(void) {
+    StrArr_view sa_v = generate(100*1000);
+    void **values = malloc(sa_v.len*sizeof(void*));
+    for (size_t i = 0; i < sa_v.len; i++) {
+        values[i] = (void*)(uintptr_t)(i + 1);
+    }
+
+    // A batch of keys already in the table only updates their values, the table keeps its size.
+    for (size_t e = 0; e < EngineCount; e++) {
+        HT ht = ht_newEngine(0, ht_HashWY, all_engines[e]);
+        for (size_t i = 0; i < sa_v.len; i++) {
+            TEST_ASSERT_EQUAL(0, ht_insert(&ht, (unsigned char*)sa_v.arr[i], NULL));
+        }
+        size_t cap = ht.cap;
+        TEST_ASSERT_EQUAL(0, ht_insert_batch(&ht, (unsigned char**)sa_v.arr, values, sa_v.len, 0));
+        TEST_ASSERT_EQUAL(cap, ht.cap);
+        TEST_ASSERT_EQUAL(sa_v.len, ht.len);
+        for (size_t i = 0; i < sa_v.len; i++) {
+            TEST_ASSERT_EQUAL(i + 1, (uintptr_t)ht_read(&ht, (unsigned char*)sa_v.arr[i]));
+        }
+        ht_free(&ht);
+    }
+
+    // A batch into a migrating table advances the migration by its steps, it does not finish it.
+    HT ht = ht_new(0, ht_HashWY);
+    TEST_ASSERT_EQUAL(0, ht_setRehashStep(&ht, 1));
+    size_t i = 0;
+    while (!ht.old_table) {
+        TEST_ASSERT_EQUAL(0, ht_insert(&ht, (unsigned char*)sa_v.arr[i], values[i]));
+        i++;
+    }
+    TEST_ASSERT_EQUAL(0, ht_insert_batch(&ht, (unsigned char**)&sa_v.arr[i], &values[i], 100, 0));
+    TEST_ASSERT_NOT_NULL(ht.old_table);
+    // The resize and the insert that started the migration took a step each, the batch one per key.
+    TEST_ASSERT_EQUAL(102, ht.rehash_idx);
+    for (size_t k = 0; k < i + 100; k++) {
+        TEST_ASSERT_EQUAL(k + 1, (uintptr_t)ht_read(&ht, (unsigned char*)sa_v.arr[k]));
+    }
+    ht_free(&ht);
+
+    free(values);
+    str_arr_free(sa_v);
+}
+
+static void benchInsertBatchIntoLargeTable(void) {
+    const size_t keys = 32*1000;
+    const size_t batch = 256;
+    StrArr_view sa_v = generate(keys);
+    char names[2][16] = {"ht_insert", "ht_insert_batch"};
+
+    for (size_t n = 0; n < 2; n++) {
+        HT ht = ht_new(4*1024*1024, ht_HashWY);
+        struct timeval begin, end;
+        gettimeofday(&begin, 0);
+
+        for (size_t i = 0; i < keys; i += batch) {
+            if (n) {
+                ht_insert_batch(&ht, (unsigned char**)&sa_v.arr[i], (void**)&sa_v.arr[i], batch, 0);
+                continue;
+            }
+            for (size_t k = i; k < i + batch; k++) {
+                ht_insert(&ht, (unsigned char*)sa_v.arr[k], sa_v.arr[k]);
+            }
+        }
+
+        gettimeofday(&end, 0);
+        long seconds = end.tv_sec - begin.tv_sec;
+        long microseconds = end.tv_usec - begin.tv_usec;
+        double elapsed = seconds + microseconds*1e-6;
+        printf("Loading %zu keys in batches of %zu into a table of %zu buckets with %s took [ %f_sec ]\n",
+               ht.len, batch, ht.cap, names[n], elapsed);
+        ht_free(&ht);
+    }
+    str_arr_free(sa_v);
+}
+
+static void testDeleteBatchAllEngines(void) {
+    StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
+    void **values = malloc(sa_v.len*sizeof(void*));
+
+    for (size_t e = 0; e < EngineCount; e++) {
+        // Every other key is in the table, the batch deletes all keys but the last seven, absent ones included.
+        HT ht = ht_newEngine(0, ht_HashDJB2, all_engines[e]);
+        TEST_ASSERT_EQUAL(0, ht_setRehashStep(&ht, e == 0 ? 1 : 0));
+        for (size_t i = 0; i < sa_v.len; i += 2) {
+            TEST_ASSERT_EQUAL(0, ht_insert(&ht, (unsigned char*)sa_v.arr[i], (void*)sa_v.arr[i]));
+        }
+        size_t count = sa_v.len - 7;
+        size_t deleted = ht_delete_batch(&ht, (unsigned char**)sa_v.arr, count, values);
+        TEST_ASSERT_EQUAL((count + 1)/2, deleted);
+        TEST_ASSERT_EQUAL((sa_v.len + 1)/2 - deleted, ht.len);
+        for (size_t i = 0; i < count; i++) {
+            TEST_ASSERT_EQUAL_PTR(i%2 ? NULL : sa_v.arr[i], values[i]);
+        }
+        for (size_t i = 0; i < sa_v.len; i++) {
+            void *expected = i >= count && i%2 == 0 ? sa_v.arr[i] : NULL;
+            TEST_ASSERT_EQUAL_PTR(expected, ht_read(&ht, (unsigned char*)sa_v.arr[i]));
+        }
+        TEST_ASSERT_EQUAL(ht.min_cap, ht.cap);
+        size_t remaining = ht.len;
+        TEST_ASSERT_EQUAL(remaining, ht_delete_batch(&ht, (unsigned char**)&sa_v.arr[count], sa_v.len - count, NULL));
+        TEST_ASSERT_EQUAL(0, ht.len);
+        ht_free(&ht);
+    }
+    free(values);
+    str_arr_free(sa_v);
+}
+
+static int keepEven(const Entity *en, void *ctx) {
+    size_t *visited = ctx;
+    (*visited)++;
+    return (uintptr_t)en->value%2 == 0;
+}
+
+static void testRetainAllEngines(void) {
+    StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
+
+    for (size_t variant = 0; variant < 2; variant++) {
+        for (size_t e = 0; e < EngineCount; e++) {
+            // The second variant keeps the chained table migrating while the predicate runs.
+            HT ht = ht_newEngine(0, ht_HashDJB2, all_engines[e]);
+            TEST_ASSERT_EQUAL(0, ht_setRehashStep(&ht, variant));
+            for (size_t i = 0; i < sa_v.len; i++) {
+                TEST_ASSERT_EQUAL(0, ht_insert(&ht, (unsigned char*)sa_v.arr[i], (void*)(uintptr_t)i));
+            }
+            size_t visited = 0;
+            size_t removed = ht_retain(&ht, keepEven, &visited);
+            TEST_ASSERT_EQUAL(sa_v.len, visited);
+            TEST_ASSERT_EQUAL(sa_v.len/2, removed);
+            TEST_ASSERT_EQUAL(sa_v.len - removed, ht.len);
+            for (size_t i = 0; i < sa_v.len; i++) {
+                void *value = ht_read(&ht, (unsigned char*)sa_v.arr[i]);
+                if (i%2) {
+                    TEST_ASSERT_NULL(value);
+                } else {
+                    TEST_ASSERT_EQUAL(i, (uintptr_t)value);
+                }
+            }
+            size_t iterated = 0;
+            Iterator it = ht_newIterator();
+            while (ht_next(&ht, &it)) {
+                iterated++;
+            }
+            TEST_ASSERT_EQUAL(ht.len, iterated);
+            for (size_t i = 0; i < sa_v.len; i += 2) {
+                TEST_ASSERT_EQUAL(i, (uintptr_t)ht_delete(&ht, (unsigned char*)sa_v.arr[i]));
+            }
+            TEST_ASSERT_EQUAL(0, ht.len);
+            ht_free(&ht);
+        }
+    }
+    str_arr_free(sa_v);
+}
+
+static void benchRetainVsCollectAndDelete(void) {
+    const size_t keys = 1000*1000;
+    StrArr_view sa_v = generate(keys);
+    unsigned char **expired = malloc(keys*sizeof(unsigned char*));
+    char names[3][28] = {"ht_next and ht_delete", "ht_next and ht_delete_batch", "ht_retain"};
+
+    for (size_t n = 0; n < 3; n++) {
+        HT ht = ht_new(keys, ht_HashWY);
+        for (size_t i = 0; i < keys; i++) {
+            ht_insert_new(&ht, (unsigned char*)sa_v.arr[i], (void*)(uintptr_t)i);
+        }
+        struct timeval begin, end;
+        gettimeofday(&begin, 0);
+
+        size_t visited = 0;
+        if (n == 2) {
+            ht_retain(&ht, keepEven, &visited);
+        } else {
+            size_t count = 0;
+            Iterator it = ht_newIterator();
+            for (Entity *en = ht_next(&ht, &it); en; en = ht_next(&ht, &it)) {
+                if (!keepEven(en, &visited)) {
+                    expired[count++] = en->key;
+                }
+            }
+            if (n == 1) {
+                ht_delete_batch(&ht, expired, count, NULL);
+            }
+            for (size_t i = 0; n == 0 && i < count; i++) {
+                ht_delete(&ht, expired[i]);
+            }
+        }
+
+        gettimeofday(&end, 0);
+        long seconds = end.tv_sec - begin.tv_sec;
+        long microseconds = end.tv_usec - begin.tv_usec;
+        double elapsed = seconds + microseconds*1e-6;
+        printf("Expiring half of %zu entities with %s took [ %f_sec ]\n", visited, names[n], elapsed);
+
+        ht_free(&ht);
+    }
+    free(expired);
+    str_arr_free(sa_v);
+}
+
+static void testIteratorSkipsEmptyBuckets(void) {
+    StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
+    const size_t cap = 1 << 16;
+
+    // The first variant grows from a small table, the second leaves most of a large one empty,
+    // the third keeps the table migrating while the keys are inserted.
+    for (size_t variant = 0; variant < 3; variant++) {
+        HT ht = ht_new(variant == 1 ? cap : 0, ht_HashDJB2);
+        TEST_ASSERT_EQUAL(0, ht_setRehashStep(&ht, variant == 2 ? 1 : 0));
+        size_t keys = variant == 1 ? 100 : sa_v.len;
+        for (size_t i = 0; i < keys; i++) {
+            TEST_ASSERT_EQUAL(0, ht_insert(&ht, (unsigned char*)sa_v.arr[i], (void*)(uintptr_t)(i + 1)));
+        }
+        for (size_t i = 0; i < keys; i += 3) {
+            TEST_ASSERT_EQUAL(i + 1, (uintptr_t)ht_delete(&ht, (unsigned char*)sa_v.arr[i]));
+        }
+
+        unsigned char *seen = calloc(keys, 1);
+        size_t visited = 0;
+        Iterator it = ht_newIterator();
+        for (Entity *en = ht_next(&ht, &it); en; en = ht_next(&ht, &it)) {
+            size_t i = (uintptr_t)en->value - 1;
+            TEST_ASSERT_TRUE(i < keys && i%3 != 0);
+            TEST_ASSERT_EQUAL(0, seen[i]);
+            seen[i] = 1;
+            visited++;
+        }
+        TEST_ASSERT_EQUAL(ht.len, visited);
+        for (size_t b = 0; b < ht.cap; b++) {
+            TEST_ASSERT_EQUAL(ht.table[b].len > 0, (ht.occupied[b/64] >> (b%64)) & 1);
+        }
+
+        // Emptied buckets clear their bits, so a drained table has none set.
+        for (size_t i = 0; i < keys; i++) {
+            if (i%3 != 0) {
+                TEST_ASSERT_EQUAL(i + 1, (uintptr_t)ht_delete(&ht, (unsigned char*)sa_v.arr[i]));
+            }
+        }
+        while (ht.old_table) {
+            ht_read(&ht, (unsigned char*)sa_v.arr[0]);
+        }
+        for (size_t w = 0; w < (ht.cap + 63)/64; w++) {
+            TEST_ASSERT_EQUAL(0, ht.occupied[w]);
+        }
+        free(seen);
+        ht_free(&ht);
+    }
+    str_arr_free(sa_v);
+}
+
+static void benchIterateSparseTable(void) {
+    const size_t cap = 4*1024*1024;
+    const size_t keys = 1000;
+    const size_t rounds = 100;
+    StrArr_view sa_v = generate(keys);
+
+    struct timeval begin, end;
+    gettimeofday(&begin, 0);
+
+    HT ht = ht_new(cap, ht_HashWY);
+    for (size_t i = 0; i < keys; i++) {
+        ht_insert(&ht, (unsigned char*)sa_v.arr[i], sa_v.arr[i]);
+    }
+    size_t visited = 0;
+    for (size_t r = 0; r < rounds; r++) {
+        Iterator it = ht_newIterator();
+        while (ht_next(&ht, &it)) {
+            visited++;
+        }
+    }
+    ht_free(&ht);
+
+    gettimeofday(&end, 0);
+    long seconds = end.tv_sec - begin.tv_sec;
+    long microseconds = end.tv_usec - begin.tv_usec;
+    double elapsed = seconds + microseconds*1e-6;
+    printf("Iterating %zu times over %zu entities in %zu buckets and freeing the table took [ %f_sec ]\n",
+           rounds, visited/rounds, cap, elapsed);
+
+    str_arr_free(sa_v);
+}
+
+static void testIteratorRangesCoverTable(void) {
+    StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
+    size_t parts[5] = {1, 2, 3, 7, 1000};
+    unsigned char *seen = malloc(sa_v.len);
+
+    for (size_t e = 0; e < EngineCount; e++) {
+        // The chained table is still migrating when the ranges are made.
+        HT ht = ht_newEngine(0, ht_HashDJB2, all_engines[e]);
+        TEST_ASSERT_EQUAL(0, ht_setRehashStep(&ht, e == 0 ? 1 : 0));
+        for (size_t i = 0; i < sa_v.len; i++) {
+            TEST_ASSERT_EQUAL(0, ht_insert(&ht, (unsigned char*)sa_v.arr[i], (void*)(uintptr_t)i));
+        }
+        for (size_t p = 0; p < 5; p++) {
+            memset(seen, 0, sa_v.len);
+            size_t visited = 0;
+            for (size_t part = 0; part < parts[p]; part++) {
+                Iterator it = ht_iterator_range(&ht, part, parts[p]);
+                for (Entity *en = ht_next(&ht, &it); en; en = ht_next(&ht, &it)) {
+                    size_t i = (uintptr_t)en->value;
+                    TEST_ASSERT_EQUAL(0, seen[i]);
+                    seen[i] = 1;
+                    visited++;
+                }
+            }
+            TEST_ASSERT_EQUAL(sa_v.len, visited);
+        }
+        Iterator it = ht_iterator_range(&ht, 1, 1);
+        TEST_ASSERT_NULL(ht_next(&ht, &it));
+        ht_free(&ht);
+    }
+    free(seen);
+    str_arr_free(sa_v);
+}
+
+// WorkerSum is padded to a cache line, so the workers do not write to a shared line.
+typedef struct {
+    uint64_t sum;
+    size_t count;
+    char pad[48];
+} WorkerSum;
+
+typedef struct {
+    WorkerSum w[8];
+} WorkerSums;
+
+static void sumValue(Entity *en, size_t worker, void *ctx) {
+    WorkerSums *ws = ctx;
+    ws->w[worker].sum += (uintptr_t)en->value;
+    ws->w[worker].count++;
+}
+
+static void testForEachParallelAllEngines(void) {
+    StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
+    uint64_t expected = 0;
+    for (size_t i = 0; i < sa_v.len; i++) {
+        expected += i;
+    }
+
+    for (size_t e = 0; e < EngineCount; e++) {
+        HT ht = ht_newEngine(0, ht_HashDJB2, all_engines[e]);
+        for (size_t i = 0; i < sa_v.len; i++) {
+            TEST_ASSERT_EQUAL(0, ht_insert(&ht, (unsigned char*)sa_v.arr[i], (void*)(uintptr_t)i));
+        }
+        for (size_t workers = 1; workers <= 8; workers *= 2) {
+            ht_Pool *pool = ht_pool_new(workers);
+            TEST_ASSERT_NOT_NULL(pool);
+            // The pool is reused, every round wakes the same threads.
+            for (size_t round = 0; round < 3; round++) {
+                WorkerSums ws = {0};
+                TEST_ASSERT_EQUAL(0, ht_for_each_parallel(&ht, pool, sumValue, &ws));
+                uint64_t sum = 0;
+                size_t count = 0;
+                for (size_t w = 0; w < 8; w++) {
+                    TEST_ASSERT_TRUE(w < workers || ws.w[w].count == 0);
+                    sum += ws.w[w].sum;
+                    count += ws.w[w].count;
+                }
+                TEST_ASSERT_EQUAL(sa_v.len, count);
+                TEST_ASSERT_EQUAL(expected, sum);
+            }
+            ht_pool_free(pool);
+        }
+        ht_free(&ht);
+    }
+    ht_Pool *pool = ht_pool_new(2);
+    TEST_ASSERT_EQUAL(ht_ErrDoNotExists, ht_for_each_parallel(NULL, pool, sumValue, NULL));
+    ht_pool_free(pool);
+    str_arr_free(sa_v);
+}
+
+static void benchForEachParallelScaling(void) {
+    const size_t keys = 4*1000*1000;
+    StrArr_view sa_v = generate(keys);
+    HT ht = ht_new(keys, ht_HashWY);
+    for (size_t i = 0; i < keys; i++) {
+        ht_insert_new(&ht, (unsigned char*)sa_v.arr[i], (void*)(uintptr_t)i);
+    }
+
+    for (size_t workers = 1; workers <= 8; workers *= 2) {
+        ht_Pool *pool = ht_pool_new(workers);
+        WorkerSums ws = {0};
+        struct timeval begin, end;
+        gettimeofday(&begin, 0);
+
+        ht_for_each_parallel(&ht, pool, sumValue, &ws);
+
+        gettimeofday(&end, 0);
+        long seconds = end.tv_sec - begin.tv_sec;
+        long microseconds = end.tv_usec - begin.tv_usec;
+        double elapsed = seconds + microseconds*1e-6;
+        printf("Scanning %zu entities with ht_for_each_parallel on %zu workers took [ %f_sec ]\n", ht.len, workers, elapsed);
+        ht_pool_free(pool);
+    }
+    ht_free(&ht);
+    str_arr_free(sa_v);
+}
+
+static void testNextBatchAllEngines(void) {
+    StrArr_view sa_v = read("./test-data/probable-v2-wpa-top4800.txt");
+    size_t sizes[4] = {1, 3, 64, 10000};
+    Entity *batch[10000];
+    unsigned char *seen = malloc(sa_v.len);
+
+    for (size_t e = 0; e < EngineCount; e++) {
+        HT ht = ht_newEngine(0, ht_HashDJB2, all_engines[e]);
+        TEST_ASSERT_EQUAL(0, ht_setRehashStep(&ht, e == 0 ? 1 : 0));
+        for (size_t i = 0; i < sa_v.len; i++) {
+            TEST_ASSERT_EQUAL(0, ht_insert(&ht, (unsigned char*)sa_v.arr[i], (void*)(uintptr_t)i));
+        }
+        for (size_t s = 0; s < 4; s++) {
+            // Every other batch is taken with ht_next one entity at a time, the two share the iterator.
+            memset(seen, 0, sa_v.len);
+            size_t visited = 0;
+            Iterator it = ht_newIterator();
+            for (size_t round = 0;; round++) {
+                size_t n = 0;
+                if (round%2) {
+                    for (Entity *en = NULL; n < sizes[s] && (en = ht_next(&ht, &it)); n++) {
+                        batch[n] = en;
+                    }
+                } else {
+                    n = ht_next_batch(&ht, &it, batch, sizes[s]);
+                }
+                if (n == 0) {
+                    break;
+                }
+                TEST_ASSERT_TRUE(n <= sizes[s]);
+                for (size_t k = 0; k < n; k++) {
+                    size_t i = (uintptr_t)batch[k]->value;
+                    TEST_ASSERT_EQUAL(0, seen[i]);
+                    seen[i] = 1;
+                    visited++;
+                }
+            }
+            TEST_ASSERT_EQUAL(sa_v.len, visited);
+            TEST_ASSERT_EQUAL(0, ht_next_batch(&ht, &it, batch, sizes[s]));
+        }
+
+        size_t visited = 0;
+        for (size_t part = 0; part < 3; part++) {
+            Iterator it = ht_iterator_range(&ht, part, 3);
+            for (size_t n = ht_next_batch(&ht, &it, batch, 100); n; n = ht_next_batch(&ht, &it, batch, 100)) {
+                visited += n;
+            }
+        }
+        TEST_ASSERT_EQUAL(sa_v.len, visited);
+        ht_free(&ht);
+    }
+    free(seen);
+    str_arr_free(sa_v);
+}
+
+static void benchNextBatchExport(void) {
+    const size_t keys = 4*1000*1000;
+    const size_t batch = 256;
+    StrArr_view sa_v = generate(keys);
+    Entity **out = malloc(batch*sizeof(Entity*));
+    HT ht = ht_new(keys, ht_HashWY);
+    for (size_t i = 0; i < keys; i++) {
+        ht_insert_new(&ht, (unsigned char*)sa_v.arr[i], (void*)(uintptr_t)i);
+    }
+
+    for (size_t n = 0; n < 2; n++) {
+        struct timeval begin, end;
+        gettimeofday(&begin, 0);
+
+        size_t exported = 0;
+        uint64_t sum = 0;
+        Iterator it = ht_newIterator();
+        if (n) {
+            for (size_t m = ht_next_batch(&ht, &it, out, batch); m; m = ht_next_batch(&ht, &it, out, batch)) {
+                for (size_t i = 0; i < m; i++) {
+                    sum += out[i]->key_len + (uintptr_t)out[i]->value;
+                }
+                exported += m;
+            }
+        } else {
+            for (Entity *en = ht_next(&ht, &it); en; en = ht_next(&ht, &it)) {
+                sum += en->key_len + (uintptr_t)en->value;
+                exported++;
+            }
+        }
+
+        gettimeofday(&end, 0);
+        long seconds = end.tv_sec - begin.tv_sec;
+        long microseconds = end.tv_usec - begin.tv_usec;
+        double elapsed = seconds + microseconds*1e-6;
+        printf("Exporting %zu entities with %s took [ %f_sec ], checksum %llu\n",
+               exported, n ? "ht_next_batch" : "ht_next", elapsed, (unsigned long long)sum);
+    }
+    ht_free(&ht);
+    free(out);
+    str_arr_free(sa_v);
+}
+
+static void testIteratorSpreadsMigration(void) {
+    StrArr_view sa_v = generate(100*1000);
+    unsigned char *seen = malloc(sa_v.len);
+
+    // The first table grows and the second shrinks by several halvings at once, both iterated while migrating.
+    for (size_t variant = 0; variant < 2; variant++) {
+        HT ht = ht_new(0, ht_HashSDBM);
+        TEST_ASSERT_EQUAL(0, ht_setRehashStep(&ht, 1));
+        TEST_ASSERT_EQUAL(0, ht_setLoadFactor(&ht, 1.0, variant ? 0.25 : 0.0));
+        size_t live = 0;
+        for (; live < sa_v.len; live++) {
+            TEST_ASSERT_EQUAL(0, ht_insert(&ht, (unsigned char*)sa_v.arr[live], (void*)(uintptr_t)live));
+            if (variant == 0 && ht.old_table && live > 50*1000) {
+                live++;
+                break;
+            }
+        }
+        size_t first = 0;
+        if (variant) {
+            while (ht.old_table) {
+                ht_read(&ht, (unsigned char*)sa_v.arr[0]);
+            }
+            TEST_ASSERT_EQUAL(0, ht_setLoadFactor(&ht, 1.0, 0.45));
+            first = 90*1000;
+            TEST_ASSERT_EQUAL(first, ht_delete_batch(&ht, (unsigned char**)sa_v.arr, first, NULL));
+            TEST_ASSERT_TRUE(ht.old_cap >= ht.cap*4);
+        }
+        TEST_ASSERT_NOT_NULL(ht.old_table);
+
+        // Concurrent ranges read the old buckets in place.
+        size_t old_idx = ht.rehash_idx;
+        size_t visited = 0;
+        memset(seen, 0, sa_v.len);
+        for (size_t part = 0; part < 5; part++) {
+            Iterator it = ht_iterator_range(&ht, part, 5);
+            for (Entity *en = ht_next(&ht, &it); en; en = ht_next(&ht, &it)) {
+                size_t i = (uintptr_t)en->value;
+                TEST_ASSERT_TRUE(i >= first && i < live);
+                TEST_ASSERT_EQUAL(0, seen[i]);
+                seen[i] = 1;
+                visited++;
+            }
+        }
+        TEST_ASSERT_EQUAL(live - first, visited);
+        TEST_ASSERT_EQUAL(old_idx, ht.rehash_idx);
+
+        // A sequential iterator migrates as it goes and reads interleaved with it migrate too.
+        visited = 0;
+        memset(seen, 0, sa_v.len);
+        Iterator it = ht_newIterator();
+        TEST_ASSERT_NOT_NULL(ht_next(&ht, &it));
+        TEST_ASSERT_NOT_NULL(ht.old_table);
+        it = ht_newIterator();
+        for (Entity *en = ht_next(&ht, &it); en; en = ht_next(&ht, &it)) {
+            size_t i = (uintptr_t)en->value;
+            TEST_ASSERT_EQUAL(0, seen[i]);
+            seen[i] = 1;
+            visited++;
+            TEST_ASSERT_EQUAL_PTR(en->value, ht_read(&ht, en->key));
+            ht_read(&ht, (unsigned char*)sa_v.arr[first + (i*7919)%(live - first)]);
+        }
+        TEST_ASSERT_EQUAL(live - first, visited);
+        ht_free(&ht);
+    }
+    free(seen);
+    str_arr_free(sa_v);
+}
+
+static void benchIteratorLatencyDuringMigration(void) {
+    StrArr_view sa_v = generate(2*1000*1000);
+    HT ht = ht_new(0, ht_HashWY);
+    ht_setRehashStep(&ht, 4);
+    size_t inserted = 0;
+    for (; inserted < sa_v.len; inserted++) {
+        ht_insert(&ht, (unsigned char*)sa_v.arr[inserted], sa_v.arr[inserted]);
+        if (ht.old_table && inserted > sa_v.len/2) {
+            break;
+        }
+    }
+
+    double slowest = 0;
+    size_t visited = 0;
+    struct timeval begin, end, op_begin, op_end;
+    gettimeofday(&begin, 0);
+    Iterator it = ht_newIterator();
+    for (;;) {
+        gettimeofday(&op_begin, 0);
+        Entity *en = ht_next(&ht, &it);
+        gettimeofday(&op_end, 0);
+        double op = (op_end.tv_sec - op_begin.tv_sec) + (op_end.tv_usec - op_begin.tv_usec)*1e-6;
+        if (op > slowest) {
+            slowest = op;
+        }
+        if (!en) {
+            break;
+        }
+        visited++;
+    }
+    gettimeofday(&end, 0);
+    long seconds = end.tv_sec - begin.tv_sec;
+    long microseconds = end.tv_usec - begin.tv_usec;
+    double elapsed = seconds + microseconds*1e-6;
+    printf("Iterating over %zu entities of a migrating table took [ %f_sec ], the slowest ht_next took [ %f_sec ]\n",
+           visited, elapsed, slowest);
+
+    ht_free(&ht);
+    str_arr_free(sa_v);
+}
+
+int main(void)
+{
+    UnityBegin("ht_test.c");
+
+    RUN_TEST(testHashCollisionsDjb2Success);
+    RUN_TEST(testHashCollisionsSdbmSuccess);
+    RUN_TEST(testHashCollisionsLL);
+    RUN_TEST(testHashCollisionsWYSuccess);
+    RUN_TEST(testHashCollisionsHWSuccess);
+    
+    RUN_TEST(bechHashCollisionsDjb2);
+    RUN_TEST(benchHashCollisionsSdbm);
+    RUN_TEST(benchHashCollisionsLL );
+    RUN_TEST(benchHashCollisionsWY);
+    RUN_TEST(benchHashCollisionsHW);
+
+    for (size_t n = 0; n < EngineCount; n++) {
+        test_engine = all_engines[n];
+        RUN_TEST(testInsertAllHashFunc);
+        RUN_TEST(testReadAllHashFunc);
+        RUN_TEST(testDeleteAllHashfunc);
+        RUN_TEST(testIteratorAllhashfunc);
+    }
+    test_engine = ht_EngineChained;
+    
+    RUN_TEST(benchInsertAllHashFunc);
+    RUN_TEST(benchReadAllHashFunc);
+    RUN_TEST(benchDeleteAllHashFunc);
+    RUN_TEST(benchIteratorAllHashFunc);
+
+    RUN_TEST(testGrowBeyondMinSize);
+    RUN_TEST(testShrinkToMinCap);
+    RUN_TEST(testInsertUpdateKeepsLen);
+    RUN_TEST(benchInsertGrowing);
+
+    RUN_TEST(testIncrementalRehash);
+    RUN_TEST(testIteratorDuringMigration);
+    RUN_TEST(benchInsertLatencyRehash);
+
+    RUN_TEST(benchBucketIndex);
+    RUN_TEST(benchReadLookupCost);
+
+    RUN_TEST(testEntityCachesHash);
+
+    RUN_TEST(testSwissEngineGrowAndChurn);
+    RUN_TEST(benchReadEngines);
+
+    RUN_TEST(testRobinHoodHighLoad);
+    RUN_TEST(benchEnginesAtHighLoad);
+
+    RUN_TEST(testCuckooHighLoad);
+
+    RUN_TEST(testHopscotchHighLoad);
+    RUN_TEST(testStashTakesEqualHashes);
+
+    RUN_TEST(testLengthHashesMatch);
+    RUN_TEST(testBinaryKeysAllEngines);
+    RUN_TEST(testLengthAndStringKeysAgree);
+    RUN_TEST(benchHashLengthVariants);
+
+    RUN_TEST(testHashWYSpreadsAllBits);
+    RUN_TEST(testHashHWSpreadsAllBits);
+    RUN_TEST(benchHashThroughputByKeyLength);
+
+    RUN_TEST(testSeededAllEngines);
+    RUN_TEST(testSeedIsPerTable);
+    RUN_TEST(testSeededHashSpreadsCollidingKeys);
+    RUN_TEST(benchInsertCollidingKeys);
+
+    RUN_TEST(testHashBatchMatchesScalar);
+    RUN_TEST(benchHashBatch);
+    RUN_TEST(testFinalizerSpreadsWeakHash);
+    RUN_TEST(testFinalizerAllEngines);
+    RUN_TEST(testKeyHandleSkipsHashing);
+    RUN_TEST(testKeyHandleRehashesForOtherTables);
+    RUN_TEST(benchReadKeyAcrossTables);
+    RUN_TEST(testEntryCountsAllEngines);
+    RUN_TEST(testGetOrInsertAndUpdateWith);
+    RUN_TEST(benchCountingReadInsertVsEntry);
+    RUN_TEST(testInsertReplaceReturnsDisplaced);
+    RUN_TEST(testInsertNewAllEngines);
+    RUN_TEST(benchInsertNewVsInsert);
+    RUN_TEST(testReadBatchAllEngines);
+    RUN_TEST(benchReadBatchLargeTable);
+    RUN_TEST(testInsertBatchAllEngines);
+    RUN_TEST(benchInsertBatchColdStart);
+    RUN_TEST(testInsertBatchGrowsForAbsentKeys);
+    RUN_TEST(benchInsertBatchIntoLargeTable);
+    RUN_TEST(testDeleteBatchAllEngines);
+    RUN_TEST(testRetainAllEngines);
+    RUN_TEST(benchRetainVsCollectAndDelete);
+    RUN_TEST(testIteratorSkipsEmptyBuckets);
+    RUN_TEST(benchIterateSparseTable);
+    RUN_TEST(testIteratorRangesCoverTable);
+    RUN_TEST(testForEachParallelAllEngines);
+    RUN_TEST(benchForEachParallelScaling);
+    RUN_TEST(testNextBatchAllEngines);
+    RUN_TEST(benchNextBatchExport);
+    RUN_TEST(testIteratorSpreadsMigration);
+    RUN_TEST(benchIteratorLatencyDuringMigration);
 
 
     